@@ -0,0 +1,287 @@
+#define _GNU_SOURCE // for getopt, clock_gettime and mkdir
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "sim.h"
+#include "shellcmds.h"
+#include "pool.h"
+#include "dump.h"
+
+/* armsh-batch runs every job of a manifest on its own simulator, spread over
+ * all host cores. A manifest has one job per line, blank lines and lines
+ * starting with # are skipped:
+ *
+ *     <hexfile> [budget=<n>] [engine=interp|blocks|jit] [r<n>=0x<v>]... [mdump=0x<low>:0x<high>]... [nonzero]
+ *
+ * nonzero leaves the zero words out of the mdumps.
+ * Job n (counting from 0 in manifest order) writes what `rdump` and `mdump`
+ * would print after `run` to <outdir>/<n>.out, and gets a line in
+ * <outdir>/summary.csv.
+ */
+
+#define MAX_DUMPS 16
+#define DEFAULT_BUDGET 100000000
+
+enum JobStatus {
+    JOB_HALTED, ///> ran until swi #10
+    JOB_FAULT, ///> stopped by an access outside the memory map
+    JOB_BUDGET, ///> still running after budget instructions
+    JOB_ERROR, ///> program could not be loaded or output file opened
+};
+
+static const char *status_names[] = {"halted", "fault", "budget", "error"};
+
+struct Job {
+    char *program; ///> hex file path
+    uint64_t budget; ///> maximum number of instructions
+    enum RunEngine engine;
+    uint16_t regs_set; ///> bit n set if regs[n] is given
+    uint32_t regs[NB_REGS]; ///> initial register values
+    int nb_dumps;
+    uint32_t dumps[MAX_DUMPS][2]; ///> low and high address of each mdump
+    enum DumpMode dump_mode; ///> DUMP_HEX or DUMP_NONZERO
+
+    // filled in by run_job()
+    enum JobStatus status;
+    uint64_t nb_instr; ///> instructions executed, including the halting one
+    uint64_t wall_us; ///> wall time of loading, running and dumping
+};
+
+struct Batch {
+    struct Job *jobs;
+    size_t nb_jobs;
+    const char *outdir;
+    struct Simulator **sims; ///> one per worker, created on its first job
+};
+
+/** Parse one word of a manifest line into job.
+ * \return 0 on success, -1 if it is not understood
+ */
+static int parse_option(struct Job *job, const char *word)
+{
+    unsigned reg;
+    uint32_t value, low, high;
+    unsigned long long budget;
+    char extra;
+    if (sscanf(word, "budget=%llu%c", &budget, &extra) == 1) {
+        job->budget = budget;
+    } else if (strcmp(word, "nonzero") == 0) {
+        job->dump_mode = DUMP_NONZERO;
+    } else if (strcmp(word, "engine=interp") == 0) {
+        job->engine = RUN_INTERP;
+    } else if (strcmp(word, "engine=blocks") == 0) {
+        job->engine = RUN_BLOCKS;
+    } else if (strcmp(word, "engine=jit") == 0) {
+        job->engine = RUN_JIT;
+    } else if (sscanf(word, "r%u=0x%x%c", &reg, &value, &extra) == 2 && reg < NB_REGS) {
+        job->regs_set |= 1 << reg;
+        job->regs[reg] = value;
+    } else if (sscanf(word, "mdump=0x%x:0x%x%c", &low, &high, &extra) == 2 &&
+               job->nb_dumps < MAX_DUMPS) {
+        job->dumps[job->nb_dumps][0] = low;
+        job->dumps[job->nb_dumps][1] = high;
+        job->nb_dumps++;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/** Read all jobs of the manifest fname into batch.
+ * \return 0 on success, -1 after printing an error
+ */
+static int parse_manifest(struct Batch *batch, const char *fname, uint64_t budget)
+{
+    FILE *fp = fopen(fname, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Could not open file %s\n", fname);
+        return -1;
+    }
+    size_t capacity = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    int line_nb = 0;
+    int ret = 0;
+    while (getline(&line, &line_size, fp) != -1) {
+        line_nb++;
+        char *sep = " \n\t\r";
+        char *word = strtok(line, sep);
+        if (word == NULL || word[0] == '#') {
+            continue;
+        }
+        if (batch->nb_jobs == capacity) {
+            capacity = capacity ? 2 * capacity : 256;
+            struct Job *jobs = realloc(batch->jobs, capacity * sizeof(struct Job));
+            if (jobs == NULL) {
+                fprintf(stderr, "Error: Out of memory\n");
+                ret = -1;
+                break;
+            }
+            batch->jobs = jobs;
+        }
+        struct Job *job = &batch->jobs[batch->nb_jobs++];
+        memset(job, 0, sizeof(*job));
+        job->program = strdup(word);
+        job->budget = budget;
+        job->engine = RUN_INTERP;
+        while ((word = strtok(NULL, sep)) != NULL) {
+            if (parse_option(job, word) < 0) {
+                fprintf(stderr, "Error: %s:%d: Invalid job option `%s`\n", fname, line_nb, word);
+                ret = -1;
+            }
+        }
+    }
+    free(line);
+    fclose(fp);
+    return ret;
+}
+
+static uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/** Load, run and dump the job of the given index, on the simulator of worker */
+static void run_job(void *arg, size_t index, int worker)
+{
+    struct Batch *batch = arg;
+    struct Job *job = &batch->jobs[index];
+    uint64_t start = now_us();
+    job->status = JOB_ERROR;
+
+    if (batch->sims[worker] == NULL) {
+        batch->sims[worker] = sim_create();
+    }
+    struct Simulator *sim = batch->sims[worker];
+    char out_name[4096];
+    snprintf(out_name, sizeof(out_name), "%s/%zu.out", batch->outdir, index);
+    FILE *out = fopen(out_name, "w");
+    if (sim == NULL || out == NULL ||
+        sim_load_program(sim, job->program) < 0) {
+        if (out != NULL) {
+            fprintf(out, "Error: Could not run %s\n", job->program);
+            fclose(out);
+        }
+        job->wall_us = now_us() - start;
+        return;
+    }
+    for (int i = 0; i < NB_REGS; i++) {
+        if (job->regs_set & (1 << i)) {
+            sim_set_reg(sim, i, job->regs[i]);
+        }
+    }
+
+    switch (job->engine) {
+        case RUN_BLOCKS: job->nb_instr = sim_cpu_run_blocks(sim, job->budget); break;
+        case RUN_JIT: job->nb_instr = sim_cpu_run_jit(sim, job->budget); break;
+        default: job->nb_instr = sim_cpu_run(sim, job->budget); break;
+    }
+    struct CPUState state = sim_get_cpu_state(sim);
+    if (state.faulted) {
+        job->status = JOB_FAULT;
+        fprintf(out, "CPU Fault: access to %08x outside the memory map at PC %08x\n",
+                state.fault_address, state.regs[PC]);
+    } else {
+        job->status = state.halted ? JOB_HALTED : JOB_BUDGET;
+    }
+    dump_registers(out, &state);
+    for (int i = 0; i < job->nb_dumps; i++) {
+        uint32_t bad_addr;
+        if (dump_memory(out, sim, job->dumps[i][0], job->dumps[i][1], job->dump_mode,
+                        &bad_addr) == -1) {
+            fprintf(out, "Error: %08x is outside the memory map\n", bad_addr);
+        }
+    }
+    fclose(out);
+    job->wall_us = now_us() - start;
+}
+
+/** Write one line per job to <outdir>/summary.csv.
+ * \return 0 on success, -1 after printing an error
+ */
+static int write_summary(const struct Batch *batch)
+{
+    char fname[4096];
+    snprintf(fname, sizeof(fname), "%s/summary.csv", batch->outdir);
+    FILE *fp = fopen(fname, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Could not open file %s\n", fname);
+        return -1;
+    }
+    fprintf(fp, "job,program,status,instructions,wall_us\n");
+    for (size_t i = 0; i < batch->nb_jobs; i++) {
+        const struct Job *job = &batch->jobs[i];
+        fprintf(fp, "%zu,%s,%s,%llu,%llu\n", i, job->program, status_names[job->status],
+                (unsigned long long) job->nb_instr, (unsigned long long) job->wall_us);
+    }
+    fclose(fp);
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Run as %s [-j workers] [-o outdir] [-b budget] manifest\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    struct Batch batch = {NULL, 0, ".", NULL};
+    int nb_workers = pool_nb_cores();
+    uint64_t budget = DEFAULT_BUDGET;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:o:b:")) != -1) {
+        switch (opt) {
+            case 'j': nb_workers = atoi(optarg); break;
+            case 'o': batch.outdir = optarg; break;
+            case 'b': budget = strtoull(optarg, NULL, 0); break;
+            default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1 || nb_workers < 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (mkdir(batch.outdir, 0777) < 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: Could not create directory %s\n", batch.outdir);
+        return EXIT_FAILURE;
+    }
+    if (parse_manifest(&batch, argv[optind], budget) < 0) {
+        return EXIT_FAILURE;
+    }
+
+    batch.sims = calloc(nb_workers, sizeof(struct Simulator *));
+    uint64_t start = now_us();
+    if (batch.sims == NULL || pool_run(nb_workers, batch.nb_jobs, run_job, &batch) < 0) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    uint64_t wall_us = now_us() - start;
+
+    size_t counts[JOB_ERROR + 1] = {0};
+    uint64_t nb_instr = 0;
+    for (size_t i = 0; i < batch.nb_jobs; i++) {
+        counts[batch.jobs[i].status]++;
+        nb_instr += batch.jobs[i].nb_instr;
+    }
+    printf("%zu jobs on %d workers in %.3fs: %zu halted, %zu faulted, %zu out of budget, %zu errors, %llu instructions\n",
+           batch.nb_jobs, nb_workers, wall_us / 1e6, counts[JOB_HALTED], counts[JOB_FAULT],
+           counts[JOB_BUDGET], counts[JOB_ERROR], (unsigned long long) nb_instr);
+
+    int ret = write_summary(&batch) < 0 || counts[JOB_ERROR] ? EXIT_FAILURE : EXIT_SUCCESS;
+    for (int i = 0; i < nb_workers; i++) {
+        sim_destroy(batch.sims[i]);
+    }
+    for (size_t i = 0; i < batch.nb_jobs; i++) {
+        free(batch.jobs[i].program);
+    }
+    free(batch.jobs);
+    free(batch.sims);
+    return ret;
+}
@@ -0,0 +1,151 @@
+#define _GNU_SOURCE // for getopt and clock_gettime
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "sim.h"
+#include "shellcmds.h"
+
+/* armsh-bench measures the simulator on guest programs, such as the kernels of
+ * bench/. Each program runs runs times on each engine, in a child process of
+ * its own so that its peak RSS is its own, and gets one CSV line:
+ *
+ *     kernel,engine,status,runs,instructions,wall_us_min,wall_us_median,mips,peak_rss_kb
+ *
+ * Wall times only cover sim_cpu_run*(), the program is loaded again before
+ * each run. mips is computed from the median run.
+ */
+
+#define DEFAULT_RUNS 5
+#define DEFAULT_BUDGET 1000000000
+
+static const char *engine_names[] = {"interp", "blocks", "jit"};
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/** Kernel name of program fname: its file name without directory and extension */
+static void kernel_name(const char *fname, char *name, size_t size)
+{
+    const char *base = strrchr(fname, '/');
+    base = base != NULL ? base + 1 : fname;
+    snprintf(name, size, "%s", base);
+    char *dot = strrchr(name, '.');
+    if (dot != NULL && dot != name) {
+        *dot = '\0';
+    }
+}
+
+/** Run fname runs times on engine and print its CSV line.
+ * \return 0 on success, -1 if it could not be loaded
+ */
+static int bench(const char *fname, enum RunEngine engine, int runs, uint64_t budget)
+{
+    uint64_t *wall_ns = malloc(runs * sizeof(uint64_t));
+    struct Simulator *sim = sim_create();
+    if (wall_ns == NULL || sim == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return -1;
+    }
+    uint64_t nb_instr = 0;
+    struct CPUState state;
+    for (int i = 0; i < runs; i++) {
+        if (sim_load_program(sim, fname) < 0) {
+            return -1;
+        }
+        uint64_t start = now_ns();
+        switch (engine) {
+            case RUN_BLOCKS: nb_instr = sim_cpu_run_blocks(sim, budget); break;
+            case RUN_JIT: nb_instr = sim_cpu_run_jit(sim, budget); break;
+            default: nb_instr = sim_cpu_run(sim, budget); break;
+        }
+        wall_ns[i] = now_ns() - start;
+        state = sim_get_cpu_state(sim);
+    }
+    qsort(wall_ns, runs, sizeof(uint64_t), compare_u64);
+    uint64_t median = wall_ns[runs / 2];
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    char name[256];
+    kernel_name(fname, name, sizeof(name));
+    const char *status = state.faulted ? "fault" : state.halted ? "halted" : "budget";
+    printf("%s,%s,%s,%d,%llu,%llu,%llu,%.1f,%ld\n", name, engine_names[engine], status, runs,
+           (unsigned long long) nb_instr, (unsigned long long) wall_ns[0] / 1000,
+           (unsigned long long) median / 1000, median ? nb_instr * 1e3 / median : 0.0,
+           usage.ru_maxrss);
+    fflush(stdout);
+    sim_destroy(sim);
+    free(wall_ns);
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Run as %s [-n runs] [-e interp|blocks|jit] [-b budget] program...\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    int runs = DEFAULT_RUNS;
+    uint64_t budget = DEFAULT_BUDGET;
+    int nb_engines = RUN_JIT + 1;
+    enum RunEngine engines[RUN_JIT + 1] = {RUN_INTERP, RUN_BLOCKS, RUN_JIT};
+    int opt;
+    while ((opt = getopt(argc, argv, "n:e:b:")) != -1) {
+        switch (opt) {
+            case 'n': runs = atoi(optarg); break;
+            case 'b': budget = strtoull(optarg, NULL, 0); break;
+            case 'e':
+                nb_engines = 0;
+                for (int i = RUN_INTERP; i <= RUN_JIT; i++) {
+                    if (strcmp(optarg, engine_names[i]) == 0) {
+                        engines[nb_engines++] = i;
+                    }
+                }
+                if (nb_engines == 1) {
+                    break;
+                }
+                // fall through
+            default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (optind == argc || runs < 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int ret = EXIT_SUCCESS;
+    printf("kernel,engine,status,runs,instructions,wall_us_min,wall_us_median,mips,peak_rss_kb\n");
+    fflush(stdout);
+    for (int i = optind; i < argc; i++) {
+        for (int e = 0; e < nb_engines; e++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                _exit(bench(argv[i], engines[e], runs, budget) < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+            }
+            int status;
+            if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+                WEXITSTATUS(status) != EXIT_SUCCESS) {
+                fprintf(stderr, "Error: Could not benchmark %s on %s\n", argv[i],
+                        engine_names[engines[e]]);
+                ret = EXIT_FAILURE;
+            }
+        }
+    }
+    return ret;
+}
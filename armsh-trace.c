@@ -0,0 +1,24 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "trace.h"
+
+/* armsh-trace prints a trace written by `trace on <file>`, one line per
+ * instruction:
+ *
+ *     <pc>: <instruction> [r<n>=<value>]... [pc=<target>] [cpsr=<value>] [[<address>]<=<value>|=><value>]...
+ *
+ * listing the registers the instruction changed, then the memory it wrote
+ * (<=) or read (=>), .b for byte accesses. A "-- state" line gives all the
+ * registers whenever they changed outside of the trace, e.g. by `set`.
+ */
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "Run as %s <tracefile>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (trace_decode(argv[1], stdout) < 0) {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -38,7 +38,13 @@ void exec(struct CmdContext *ctx)
     }
     char *cmd = ctx->args[0];
     if (strcmp(cmd, "r") == 0 || strcmp(cmd, "run") == 0) {
-        cmd_run();
+        enum RunEngine engine = RUN_INTERP;
+        if (ctx->argc >= 2 && strcmp(ctx->args[1], "--blocks") == 0) {
+            engine = RUN_BLOCKS;
+        } else if (ctx->argc >= 2 && strcmp(ctx->args[1], "--jit") == 0) {
+            engine = RUN_JIT;
+        }
+        cmd_run(engine);
     } else if (strcmp(cmd, "file") == 0) {
         CHECK_ARGC_ELSE_RETURN(2);
         char *fname = ctx->args[1];
@@ -58,10 +64,17 @@ void exec(struct CmdContext *ctx)
         sscanf(ctx->args[1], "0x%x", &l);
         sscanf(ctx->args[2], "0x%x", &h);
         char * fname = NULL;
-        if (ctx->argc >= 4) {
-            fname = ctx->args[3];
+        enum DumpMode mode = DUMP_HEX;
+        for (int i = 3; i < ctx->argc; i++) {
+            if (strcmp(ctx->args[i], "--nonzero") == 0) {
+                mode = DUMP_NONZERO;
+            } else if (strcmp(ctx->args[i], "--binary") == 0) {
+                mode = DUMP_BINARY;
+            } else {
+                fname = ctx->args[i];
+            }
         }
-        cmd_mdump(l, h, fname);
+        cmd_mdump(l, h, fname, mode);
     } else if (strcmp(cmd, "rdump") == 0) {
         char * fname = NULL;
         if (ctx->argc >= 2) {
@@ -75,6 +88,77 @@ void exec(struct CmdContext *ctx)
         uint32_t rval;
         sscanf(ctx->args[2], "0x%x", &rval);
         cmd_set(rnum, rval);
+    } else if (strcmp(cmd, "snapshot") == 0) {
+        cmd_snapshot();
+    } else if (strcmp(cmd, "restore") == 0) {
+        CHECK_ARGC_ELSE_RETURN(2);
+        cmd_restore(atoi(ctx->args[1]));
+    } else if (strcmp(cmd, "checkpoint") == 0) {
+        CHECK_ARGC_ELSE_RETURN(2);
+        bool compress = ctx->argc >= 3 && strcmp(ctx->args[2], "--compress") == 0;
+        cmd_checkpoint(ctx->args[1], compress);
+    } else if (strcmp(cmd, "resume") == 0) {
+        CHECK_ARGC_ELSE_RETURN(2);
+        cmd_resume(ctx->args[1]);
+    } else if (strcmp(cmd, "trace") == 0) {
+        CHECK_ARGC_ELSE_RETURN(2);
+        if (strcmp(ctx->args[1], "on") == 0) {
+            CHECK_ARGC_ELSE_RETURN(3);
+            cmd_trace(ctx->args[2]);
+        } else if (strcmp(ctx->args[1], "off") == 0) {
+            cmd_trace(NULL);
+        } else {
+            fprintf(stderr, "%s", argerrstr);
+        }
+    } else if (strcmp(cmd, "profile") == 0) {
+        CHECK_ARGC_ELSE_RETURN(2);
+        if (strcmp(ctx->args[1], "on") == 0 || strcmp(ctx->args[1], "off") == 0) {
+            cmd_profile(strcmp(ctx->args[1], "on") == 0);
+        } else if (strcmp(ctx->args[1], "report") == 0) {
+            int n = ctx->argc >= 3 ? atoi(ctx->args[2]) : 10;
+            cmd_profile_report(n > 0 ? n : 10);
+        } else {
+            fprintf(stderr, "%s", argerrstr);
+        }
+    } else if (strcmp(cmd, "cache") == 0) {
+        CHECK_ARGC_ELSE_RETURN(2);
+        if (strcmp(ctx->args[1], "on") == 0 || strcmp(ctx->args[1], "off") == 0) {
+            cmd_cache(strcmp(ctx->args[1], "on") == 0, ctx->args + 2, ctx->argc - 2);
+        } else {
+            fprintf(stderr, "%s", argerrstr);
+        }
+    } else if (strcmp(cmd, "pipeline") == 0) {
+        CHECK_ARGC_ELSE_RETURN(2);
+        if (strcmp(ctx->args[1], "on") == 0 || strcmp(ctx->args[1], "off") == 0) {
+            cmd_pipeline(strcmp(ctx->args[1], "on") == 0, ctx->args + 2, ctx->argc - 2);
+        } else {
+            fprintf(stderr, "%s", argerrstr);
+        }
+    } else if (strcmp(cmd, "bpred") == 0) {
+        CHECK_ARGC_ELSE_RETURN(2);
+        if (strcmp(ctx->args[1], "on") == 0 || strcmp(ctx->args[1], "off") == 0) {
+            cmd_bpred(strcmp(ctx->args[1], "on") == 0, ctx->args + 2, ctx->argc - 2);
+        } else if (strcmp(ctx->args[1], "report") == 0) {
+            int n = ctx->argc >= 3 ? atoi(ctx->args[2]) : 10;
+            cmd_bpred_report(n > 0 ? n : 10);
+        } else {
+            fprintf(stderr, "%s", argerrstr);
+        }
+    } else if (strcmp(cmd, "stats") == 0) {
+        if (ctx->argc >= 2 && strcmp(ctx->args[1], "reset") == 0) {
+            cmd_stats_reset();
+            return;
+        }
+        char * fname = NULL;
+        enum StatsFormat format = STATS_TEXT;
+        for (int i = 1; i < ctx->argc; i++) {
+            if (strcmp(ctx->args[i], "--csv") == 0) {
+                format = STATS_CSV;
+            } else {
+                fname = ctx->args[i];
+            }
+        }
+        cmd_stats(fname, format);
     } else if (strcmp(cmd, "?") == 0 || strcmp(cmd, "help") == 0) {
         cmd_help();
     } else if (strcmp(cmd, "q") == 0 || strcmp(cmd, "quit") == 0) {
@@ -0,0 +1,37 @@
+@ bubble: bubble sort of 512 pseudo-random words, 16 times over fresh data
+@ result: the last sorted array, from 0x10000000 to 0x10000800
+    mov r0, #0x10000000     @ array
+    mov r2, #1              @ xorshift state
+    mov r9, #16             @ sorts
+sort:
+    mov r3, #0
+fill:
+    eor r2, r2, r2, lsl #13
+    eor r2, r2, r2, lsr #17
+    eor r2, r2, r2, lsl #5
+    str r2, [r0, r3, lsl #2]
+    add r3, r3, #1
+    cmp r3, #512
+    blt fill
+
+    mov r4, #512
+    sub r4, r4, #1          @ pairs left to compare in this sweep
+sweep:
+    mov r3, #0
+    mov r8, r0
+compare:
+    ldr r5, [r8]
+    ldr r6, [r8, #4]
+    cmp r5, r6
+    strhi r6, [r8]          @ swap without branching
+    strhi r5, [r8, #4]
+    add r8, r8, #4
+    add r3, r3, #1
+    cmp r3, r4
+    blt compare
+    subs r4, r4, #1
+    bne sweep
+
+    subs r9, r9, #1
+    bne sort
+    swi #10
@@ -0,0 +1,29 @@
+e3a00201
+e3a02001
+e3a09010
+e3a03000
+e0222682
+e02228a2
+e0222282
+e7802103
+e2833001
+e3530c02
+bafffff8
+e3a04c02
+e2444001
+e3a03000
+e1a08000
+e5985000
+e5986004
+e1550006
+85886000
+85885004
+e2888004
+e2833001
+e1530004
+bafffff6
+e2544001
+1afffff2
+e2599001
+1affffe6
+ef00000a
@@ -0,0 +1,31 @@
+@ checksum: Adler-style byte sums (modulo 2^32) over a 16 KiB buffer, 256 passes
+@ result: r4 = sum of bytes + 1, r5 = sum of the running sums
+    mov r0, #0x10000000     @ buffer
+    mov r1, #0x4000         @ buffer size in bytes
+    mov r2, #1              @ xorshift state
+    mov r3, #0
+fill:
+    eor r2, r2, r2, lsl #13
+    eor r2, r2, r2, lsr #17
+    eor r2, r2, r2, lsl #5
+    str r2, [r0, r3]
+    add r3, r3, #4
+    cmp r3, r1
+    blt fill
+
+    mov r4, #1
+    mov r5, #0
+    mov r6, #0              @ pass
+pass:
+    mov r3, #0
+sum:
+    ldrb r7, [r0, r3]
+    add r4, r4, r7
+    add r5, r5, r4
+    add r3, r3, #1
+    cmp r3, r1
+    blt sum
+    add r6, r6, #1
+    cmp r6, #256
+    blt pass
+    swi #10
@@ -0,0 +1,25 @@
+e3a00201
+e3a01901
+e3a02001
+e3a03000
+e0222682
+e02228a2
+e0222282
+e7802003
+e2833004
+e1530001
+bafffff8
+e3a04001
+e3a05000
+e3a06000
+e3a03000
+e7d07003
+e0844007
+e0855004
+e2833001
+e1530001
+bafffff9
+e2866001
+e3560c01
+bafffff5
+ef00000a
@@ -0,0 +1,38 @@
+@ list: 640 walks of a 4096 node linked list scattered over 64 KiB, adding
+@ up and incrementing the value of every node
+@ nodes are 16 bytes, {next, value}, node i at index (i * 173) mod 4096
+@ result: r8 = sum of the values seen
+    mov r0, #0x10000000     @ node 0, the head
+    mov r1, #0x1000         @ nodes
+    sub r2, r1, #1          @ index mask
+    mov r3, #0              @ i
+    mov r4, #0              @ index of node i
+build:
+    add r5, r4, #173
+    and r5, r5, r2          @ index of node i + 1
+    add r6, r0, r4, lsl #4
+    add r7, r0, r5, lsl #4
+    str r7, [r6]
+    str r3, [r6, #4]
+    mov r4, r5
+    add r3, r3, #1
+    cmp r3, r1
+    blt build
+    mov r7, #0
+    str r7, [r6]            @ the last node ends the list
+
+    mov r8, #0
+    mov r9, #640            @ walks
+walk:
+    mov r6, r0
+node:
+    ldr r5, [r6, #4]
+    add r8, r8, r5
+    add r5, r5, #1
+    str r5, [r6, #4]
+    ldr r6, [r6]
+    cmp r6, #0
+    bne node
+    subs r9, r9, #1
+    bne walk
+    swi #10
@@ -0,0 +1,30 @@
+e3a00201
+e3a01a01
+e2412001
+e3a03000
+e3a04000
+e28450ad
+e0055002
+e0806204
+e0807205
+e5867000
+e5863004
+e1a04005
+e2833001
+e1530001
+bafffff5
+e3a07000
+e5867000
+e3a08000
+e3a09d0a
+e1a06000
+e5965004
+e0888005
+e2855001
+e5865004
+e5966000
+e3560000
+1afffff8
+e2599001
+1afffff5
+ef00000a
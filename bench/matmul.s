@@ -0,0 +1,56 @@
+@ matmul: C += A * B on 32x32 word matrices, 64 times, with MUL for the row
+@ offsets and MLA for the dot products
+@ A[i][k] = i + k, B[k][j] = k - j, C starts at 0
+@ result: C from 0x10002000 to 0x10003000
+    mov r0, #0x10000000     @ A
+    add r1, r0, #0x1000     @ B
+    add r2, r0, #0x2000     @ C
+    mov r12, #128           @ row size in bytes
+
+    mov r3, #0              @ i
+init_row:
+    mov r4, #0              @ j
+init_col:
+    mul r5, r3, r12
+    add r5, r5, r4, lsl #2
+    add r6, r3, r4
+    str r6, [r0, r5]
+    sub r6, r3, r4
+    str r6, [r1, r5]
+    mov r6, #0
+    str r6, [r2, r5]
+    add r4, r4, #1
+    cmp r4, #32
+    blt init_col
+    add r3, r3, #1
+    cmp r3, #32
+    blt init_row
+
+    mov r11, #64            @ products
+product:
+    mov r3, #0              @ i
+row:
+    mov r4, #0              @ j
+col:
+    mul r5, r3, r12
+    add r7, r0, r5          @ &A[i][0]
+    add r8, r1, r4, lsl #2  @ &B[0][j]
+    add r5, r5, r4, lsl #2
+    ldr r9, [r2, r5]        @ C[i][j]
+    mov r10, #32
+dot:
+    ldr r6, [r7], #4
+    ldr r14, [r8], #128
+    mla r9, r6, r14, r9
+    subs r10, r10, #1
+    bne dot
+    str r9, [r2, r5]
+    add r4, r4, #1
+    cmp r4, #32
+    blt col
+    add r3, r3, #1
+    cmp r3, #32
+    blt row
+    subs r11, r11, #1
+    bne product
+    swi #10
@@ -0,0 +1,44 @@
+e3a00201
+e2801a01
+e2802a02
+e3a0c080
+e3a03000
+e3a04000
+e0050c93
+e0855104
+e0836004
+e7806005
+e0436004
+e7816005
+e3a06000
+e7826005
+e2844001
+e3540020
+bafffff4
+e2833001
+e3530020
+bafffff0
+e3a0b040
+e3a03000
+e3a04000
+e0050c93
+e0807005
+e0818104
+e0855104
+e7929005
+e3a0a020
+e4976004
+e498e080
+e0299e96
+e25aa001
+1afffffa
+e7829005
+e2844001
+e3540020
+bafffff0
+e2833001
+e3530020
+baffffec
+e25bb001
+1affffe9
+ef00000a
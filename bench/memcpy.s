@@ -0,0 +1,45 @@
+@ memcpy: 512 passes of a word memset and a word memcpy of 32 KiB, 4 words per
+@ iteration, then a byte copy of 1 KiB to an odd address
+@ result: memory from 0x10000000 to 0x10010400
+    mov r0, #0x10000000     @ source
+    add r1, r0, #0x8000     @ destination
+    mov r11, #512           @ passes
+pass:
+    mov r2, r0              @ memset the source to the pass number
+    mov r3, #0x800
+set:
+    str r11, [r2], #4
+    str r11, [r2], #4
+    str r11, [r2], #4
+    str r11, [r2], #4
+    subs r3, r3, #1
+    bne set
+
+    mov r2, r0              @ copy it to the destination
+    mov r4, r1
+    mov r3, #0x800
+copy:
+    ldr r5, [r2], #4
+    ldr r6, [r2], #4
+    ldr r7, [r2], #4
+    ldr r8, [r2], #4
+    str r5, [r4], #4
+    str r6, [r4], #4
+    str r7, [r4], #4
+    str r8, [r4], #4
+    subs r3, r3, #1
+    bne copy
+
+    mov r2, r0              @ and its first 1 KiB a byte at a time past it
+    add r4, r1, #0x8000
+    add r4, r4, #1
+    mov r3, #0x400
+bytes:
+    ldrb r5, [r2], #1
+    strb r5, [r4], #1
+    subs r3, r3, #1
+    bne bytes
+
+    subs r11, r11, #1
+    bne pass
+    swi #10
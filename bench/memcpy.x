@@ -0,0 +1,35 @@
+e3a00201
+e2801902
+e3a0bc02
+e1a02000
+e3a03b02
+e482b004
+e482b004
+e482b004
+e482b004
+e2533001
+1afffff9
+e1a02000
+e1a04001
+e3a03b02
+e4925004
+e4926004
+e4927004
+e4928004
+e4845004
+e4846004
+e4847004
+e4848004
+e2533001
+1afffff5
+e1a02000
+e2814902
+e2844001
+e3a03b01
+e4d25001
+e4c45001
+e2533001
+1afffffb
+e25bb001
+1affffe0
+ef00000a
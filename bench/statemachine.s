@@ -0,0 +1,69 @@
+@ statemachine: 32 passes of a tokenizer over 64 KiB of pseudo-random bytes,
+@ branching on the state and on the class of every byte (its low 2 bits:
+@ 0 and 3 blank, 1 letter, 2 digit); letters and digits after a letter make
+@ words, digits make numbers, a letter right after a number is an error
+@ result: r6 = words, r7 = numbers, r8 = errors
+    mov r0, #0x10000000     @ input
+    mov r1, #0x10000        @ input size in bytes
+    mov r2, #1              @ xorshift state
+    mov r3, #0
+fill:
+    eor r2, r2, r2, lsl #13
+    eor r2, r2, r2, lsr #17
+    eor r2, r2, r2, lsl #5
+    str r2, [r0, r3]
+    add r3, r3, #4
+    cmp r3, r1
+    blt fill
+
+    mov r6, #0
+    mov r7, #0
+    mov r8, #0
+    mov r9, #32             @ passes
+pass:
+    mov r3, #0
+    mov r4, #0              @ state: 0 blank, 1 word, 2 number
+next:
+    ldrb r5, [r0, r3]
+    and r5, r5, #3
+    cmp r4, #1
+    beq in_word
+    cmp r4, #2
+    beq in_number
+    cmp r5, #1
+    beq start_word
+    cmp r5, #2
+    beq start_number
+    b advance
+start_word:
+    add r6, r6, #1
+    mov r4, #1
+    b advance
+start_number:
+    add r7, r7, #1
+    mov r4, #2
+    b advance
+in_word:
+    cmp r5, #1
+    beq advance
+    cmp r5, #2
+    beq advance
+    mov r4, #0
+    b advance
+in_number:
+    cmp r5, #2
+    beq advance
+    cmp r5, #1
+    bne end_number
+    add r8, r8, #1
+    mov r4, #1
+    b advance
+end_number:
+    mov r4, #0
+advance:
+    add r3, r3, #1
+    cmp r3, r1
+    blt next
+    subs r9, r9, #1
+    bne pass
+    swi #10
@@ -0,0 +1,54 @@
+e3a00201
+e3a01801
+e3a02001
+e3a03000
+e0222682
+e02228a2
+e0222282
+e7802003
+e2833004
+e1530001
+bafffff8
+e3a06000
+e3a07000
+e3a08000
+e3a09020
+e3a03000
+e3a04000
+e7d05003
+e2055003
+e3540001
+0a00000c
+e3540002
+0a000010
+e3550001
+0a000002
+e3550002
+0a000003
+ea000013
+e2866001
+e3a04001
+ea000010
+e2877001
+e3a04002
+ea00000d
+e3550001
+0a00000b
+e3550002
+0a000009
+e3a04000
+ea000007
+e3550002
+0a000005
+e3550001
+1a000002
+e2888001
+e3a04001
+ea000000
+e3a04000
+e2833001
+e1530001
+baffffdd
+e2599001
+1affffd9
+ef00000a
@@ -0,0 +1,150 @@
+#include <stdlib.h>
+#include <string.h>
+#include "block.h"
+#include "isa.h"
+#include "simulator.h"
+
+/** Number of successors a block remembers */
+#define BLOCK_NB_LINKS 2
+
+struct Block {
+    uint32_t start; ///> address of first instruction
+    uint32_t nb_instr; ///> 0 if not discovered yet
+    uint32_t link_pc[BLOCK_NB_LINKS]; ///> PC the block exited with
+    struct Block *link[BLOCK_NB_LINKS]; ///> block starting there, NULL if unused
+};
+
+struct BlockCache {
+    // one slot per word of the text region, indexed by (PC - MEM_TEXT_START) / 4
+    struct Block blocks[MEM_TEXT_SIZE / 4];
+    uint8_t covered[MEM_TEXT_SIZE / 4]; ///> 1 if word is part of a block
+    uint32_t used; ///> slots from here on are all empty, keeps flushes short
+    uint32_t generation; ///> incremented by every block_flush()
+};
+
+struct BlockCache * block_create()
+{
+    return calloc(1, sizeof(struct BlockCache));
+}
+
+void block_destroy(struct BlockCache *cache)
+{
+    free(cache);
+}
+
+bool block_ends_with(const struct DecodedInstr *instr)
+{
+    switch (instr->op) {
+        case INSTR_BL: case INSTR_SWI:
+            return true;
+        case INSTR_TST: case INSTR_TEQ: case INSTR_CMP: case INSTR_CMN:
+            return false;
+        case INSTR_LDR: case INSTR_LDRB: case INSTR_STR: case INSTR_STRB:
+            if (!instr->P && instr->W) { // user mode access halts
+                return true;
+            }
+            if ((!instr->P || instr->W) && instr->rn == PC) {
+                return true;
+            }
+            return instr->L && instr->rd == PC;
+        case INSTR_UND:
+            return false;
+        default: // data processing, MUL and MLA
+            return instr->rd == PC;
+    }
+}
+
+uint32_t block_length(struct Simulator *sim, uint32_t pc)
+{
+    uint32_t nb_instr = 0;
+    for (uint32_t addr = pc; nb_instr < BLOCK_MAX_INSTR &&
+                             addr - MEM_TEXT_START < MEM_TEXT_SIZE; addr += 4) {
+        nb_instr++;
+        if (block_ends_with(isa_decoded_at(sim, addr))) {
+            break;
+        }
+    }
+    return nb_instr;
+}
+
+/** Return block starting at pc, discovering it on first use.
+ * \return NULL if pc is outside the text region or unaligned
+ */
+static struct Block * lookup(struct Simulator *sim, uint32_t pc)
+{
+    uint32_t offset = pc - MEM_TEXT_START;
+    if (offset >= MEM_TEXT_SIZE || (offset & 0x3)) {
+        return NULL;
+    }
+    struct Block *block = &sim->blocks->blocks[offset >> 2];
+    if (block->nb_instr == 0) {
+        block->start = pc;
+        block->nb_instr = block_length(sim, pc);
+        memset(&sim->blocks->covered[offset >> 2], 1, block->nb_instr);
+        if ((offset >> 2) + block->nb_instr > sim->blocks->used) {
+            sim->blocks->used = (offset >> 2) + block->nb_instr;
+        }
+    }
+    return block;
+}
+
+/** Return block following block when it exited with pc, linking them */
+static struct Block * successor(struct Simulator *sim, struct Block *block, uint32_t pc)
+{
+    for (int i = 0; i < BLOCK_NB_LINKS; i++) {
+        if (block->link[i] != NULL && block->link_pc[i] == pc) {
+            return block->link[i];
+        }
+    }
+    struct Block *next = lookup(sim, pc);
+    if (next != NULL) {
+        // fill a free slot, or replace the last one for indirect jumps
+        int i = 0;
+        while (i < BLOCK_NB_LINKS - 1 && block->link[i] != NULL) {
+            i++;
+        }
+        block->link_pc[i] = pc;
+        block->link[i] = next;
+    }
+    return next;
+}
+
+uint64_t block_run(struct Simulator *sim, uint64_t max_instr)
+{
+    uint64_t nb_instr = 0;
+    struct Block *block = lookup(sim, sim->cpu.regs[PC]);
+    while (nb_instr < max_instr && !sim->cpu.halted) {
+        if (block == NULL || block->nb_instr > max_instr - nb_instr) {
+            process_instruction(sim);
+            nb_instr++;
+            block = lookup(sim, sim->cpu.regs[PC]);
+            continue;
+        }
+        uint32_t curr_generation = sim->blocks->generation;
+        nb_instr += isa_execute_block(sim, block->start, block->nb_instr);
+        if (sim->blocks->generation != curr_generation) { // code got modified, blocks are gone
+            block = lookup(sim, sim->cpu.regs[PC]);
+            continue;
+        }
+        block = successor(sim, block, sim->cpu.regs[PC]);
+    }
+    isa_sync_flags(sim);
+    return nb_instr;
+}
+
+void block_invalidate(struct Simulator *sim, uint32_t address)
+{
+    uint32_t offset = address - MEM_TEXT_START;
+    if (offset < MEM_TEXT_SIZE && sim->blocks->covered[offset >> 2]) {
+        block_flush(sim);
+    }
+}
+
+void block_flush(struct Simulator *sim)
+{
+    struct BlockCache *cache = sim->blocks;
+    memset(cache->blocks, 0, cache->used * sizeof(struct Block));
+    memset(cache->covered, 0, cache->used);
+    cache->used = 0;
+    cache->generation++;
+}
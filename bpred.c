@@ -0,0 +1,269 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "bpred.h"
+#include "isa.h"
+#include "isa_helper.h"
+#include "simulator.h"
+
+/* Direction counters are 2-bit saturating, predicting taken from 2 on, and
+ * start weakly not taken. Branches are the B and BL instructions: those
+ * failing their condition are not taken. Counts are kept per text word, like
+ * the profile's.
+ */
+#define BPRED_SLOTS (MEM_TEXT_SIZE / 4)
+#define COUNTER_INIT 1
+#define COUNTER_TAKEN 2
+#define COUNTER_MAX 3
+
+/** An entry of the branch target buffer */
+struct BtbEntry {
+    uint32_t tag; ///> address of the branch | 1, 0 if empty
+    uint32_t target;
+    uint8_t counter;
+};
+
+struct BranchCounts {
+    uint64_t executed;
+    uint64_t taken;
+    uint64_t mispredicted;
+};
+
+struct BranchPredictor {
+    struct BranchPredictorConfig config;
+    uint32_t index_mask;
+    uint32_t history; ///> last outcomes, most recent in bit 0
+    uint8_t *counters; ///> bimodal and gshare
+    struct BtbEntry *btb;
+    struct BranchCounts total;
+    struct BranchCounts outside; ///> branches outside the text region
+    struct BranchCounts per_pc[BPRED_SLOTS];
+};
+
+static const char * const kind_names[] = {"not-taken", "bimodal", "gshare", "btb"};
+
+void bpred_default_config(struct BranchPredictorConfig *config)
+{
+    config->kind = BPRED_BIMODAL;
+    config->entries = 4096;
+    config->history_bits = 12;
+}
+
+int bpred_parse_option(struct BranchPredictorConfig *config, const char *option)
+{
+    for (int i = 0; i < 4; i++) {
+        if (strcmp(option, kind_names[i]) == 0) {
+            config->kind = i;
+            return 0;
+        }
+    }
+    char *end;
+    if (strncmp(option, "entries=", 8) == 0) {
+        unsigned long entries = strtoul(option + 8, &end, 0);
+        if (end != option + 8 && *end == '\0' && entries != 0 &&
+            (entries & (entries - 1)) == 0 && entries <= (1ul << 24)) {
+            config->entries = entries;
+            return 0;
+        }
+    } else if (strncmp(option, "history=", 8) == 0) {
+        unsigned long bits = strtoul(option + 8, &end, 0);
+        if (end != option + 8 && *end == '\0' && bits <= 24) {
+            config->history_bits = bits;
+            return 0;
+        }
+    }
+    fprintf(stderr, "Error: Bad branch predictor option %s, options are not-taken, bimodal, gshare, "
+            "btb, entries=<power of 2> and history=<bits>\n", option);
+    return -1;
+}
+
+int bpred_start(struct Simulator *sim, const struct BranchPredictorConfig *config)
+{
+    bpred_stop(sim);
+    struct BranchPredictor *predictor = calloc(1, sizeof(struct BranchPredictor));
+    bool ok = predictor != NULL;
+    if (ok && config->kind == BPRED_BTB) {
+        predictor->btb = calloc(config->entries, sizeof(struct BtbEntry));
+        ok = predictor->btb != NULL;
+    } else if (ok) {
+        predictor->counters = malloc(config->entries);
+        ok = predictor->counters != NULL;
+        if (ok) {
+            memset(predictor->counters, COUNTER_INIT, config->entries);
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: Out of memory for the branch predictor\n");
+        if (predictor != NULL) {
+            free(predictor->counters);
+            free(predictor->btb);
+        }
+        free(predictor);
+        return -1;
+    }
+    predictor->config = *config;
+    predictor->index_mask = config->entries - 1;
+    sim->bpred = predictor;
+    return 0;
+}
+
+void bpred_stop(struct Simulator *sim)
+{
+    struct BranchPredictor *predictor = sim->bpred;
+    if (predictor == NULL) {
+        return;
+    }
+    free(predictor->counters);
+    free(predictor->btb);
+    free(predictor);
+    sim->bpred = NULL;
+}
+
+static inline void train(uint8_t *counter, bool taken)
+{
+    if (taken && *counter < COUNTER_MAX) {
+        (*counter)++;
+    } else if (!taken && *counter > 0) {
+        (*counter)--;
+    }
+}
+
+bool bpred_branch(struct Simulator *sim, uint32_t pc, const struct DecodedInstr *instr)
+{
+    struct BranchPredictor *predictor = sim->bpred;
+    bool taken = true;
+    if (!condition_always(instr->cond)) {
+        isa_sync_flags(sim);
+        taken = condition_check(&sim->cpu, instr->cond);
+    }
+    // PC gets the offset, then the usual 4, see exec_BL()
+    uint32_t target = pc + instr->imm + 4;
+    uint32_t index = pc >> 2;
+    bool mispredicted;
+    switch (predictor->config.kind) {
+        case BPRED_NOT_TAKEN:
+            mispredicted = taken;
+            break;
+        case BPRED_BIMODAL: case BPRED_GSHARE:
+        {
+            if (predictor->config.kind == BPRED_GSHARE) {
+                index ^= predictor->history;
+            }
+            uint8_t *counter = &predictor->counters[index & predictor->index_mask];
+            mispredicted = (*counter >= COUNTER_TAKEN) != taken;
+            train(counter, taken);
+            uint32_t history_mask = (1u << predictor->config.history_bits) - 1;
+            predictor->history = ((predictor->history << 1) | taken) & history_mask;
+            break;
+        }
+        default: // BPRED_BTB
+        {
+            struct BtbEntry *entry = &predictor->btb[index & predictor->index_mask];
+            bool hit = entry->tag == (pc | 1);
+            bool predicted_taken = hit && entry->counter >= COUNTER_TAKEN;
+            mispredicted = predicted_taken != taken || (taken && entry->target != target);
+            if (hit) {
+                train(&entry->counter, taken);
+                entry->target = target;
+            } else if (taken) { // only taken branches get an entry
+                entry->tag = pc | 1;
+                entry->target = target;
+                entry->counter = COUNTER_TAKEN;
+            }
+            break;
+        }
+    }
+
+    uint32_t slot = (pc - MEM_TEXT_START) >> 2;
+    struct BranchCounts *counts = slot < BPRED_SLOTS ? &predictor->per_pc[slot] :
+                                                       &predictor->outside;
+    counts->executed++;
+    counts->taken += taken;
+    counts->mispredicted += mispredicted;
+    predictor->total.executed++;
+    predictor->total.taken += taken;
+    predictor->total.mispredicted += mispredicted;
+    return mispredicted;
+}
+
+void bpred_reset_counts(struct BranchPredictor *predictor)
+{
+    memset(&predictor->total, 0, sizeof(predictor->total));
+    memset(&predictor->outside, 0, sizeof(predictor->outside));
+    memset(predictor->per_pc, 0, sizeof(predictor->per_pc));
+}
+
+void bpred_print_stats(FILE *fp, const struct BranchPredictor *predictor, enum StatsFormat format)
+{
+    const struct BranchCounts *total = &predictor->total;
+    if (format == STATS_TEXT) {
+        fprintf(fp, "  branch predictor: %s", kind_names[predictor->config.kind]);
+        if (predictor->config.kind != BPRED_NOT_TAKEN) {
+            fprintf(fp, ", %u entries", predictor->config.entries);
+        }
+        if (predictor->config.kind == BPRED_GSHARE) {
+            fprintf(fp, ", %u history bits", predictor->config.history_bits);
+        }
+        fputc('\n', fp);
+    }
+    stats_print_count(fp, format, "bpred_branches", total->executed);
+    stats_print_count(fp, format, "bpred_taken", total->taken);
+    stats_print_count(fp, format, "bpred_mispredicted", total->mispredicted);
+    stats_print_real(fp, format, "bpred_mispredict_rate",
+                     total->executed > 0 ? 100.0 * total->mispredicted / total->executed : 0);
+}
+
+/** A branch of the report */
+struct BranchSpot {
+    uint32_t address;
+    const struct BranchCounts *counts;
+};
+
+int bpred_report(const struct Simulator *sim, FILE *fp, uint32_t nb_top)
+{
+    const struct BranchPredictor *predictor = sim->bpred;
+    if (predictor == NULL) {
+        return -1;
+    }
+    struct BranchSpot *top = malloc((nb_top + 1) * sizeof(struct BranchSpot));
+    if (top == NULL) {
+        fprintf(stderr, "Error: Out of memory for the branch report\n");
+        return 0;
+    }
+    // keep the nb_top worst by decreasing mispredictions, lower addresses first
+    uint32_t nb_kept = 0;
+    for (uint32_t slot = 0; slot < BPRED_SLOTS; slot++) {
+        const struct BranchCounts *counts = &predictor->per_pc[slot];
+        if (counts->executed == 0) {
+            continue;
+        }
+        uint32_t i = nb_kept;
+        while (i > 0 && top[i - 1].counts->mispredicted < counts->mispredicted) {
+            top[i] = top[i - 1];
+            i--;
+        }
+        top[i] = (struct BranchSpot) {MEM_TEXT_START + slot * 4, counts};
+        if (nb_kept < nb_top) {
+            nb_kept++;
+        }
+    }
+
+    bpred_print_stats(fp, predictor, STATS_TEXT);
+    fprintf(fp, "    executed    taken%%  mispredicted      %%  address\n");
+    for (uint32_t i = 0; i < nb_kept; i++) {
+        const struct BranchCounts *counts = top[i].counts;
+        fprintf(fp, "%12llu %8.2f %13llu %6.2f  %08x", (unsigned long long) counts->executed,
+                100.0 * counts->taken / counts->executed,
+                (unsigned long long) counts->mispredicted,
+                100.0 * counts->mispredicted / counts->executed, top[i].address);
+        uint32_t offset;
+        const char *name = sim_symbol_at(sim, top[i].address, &offset);
+        if (name != NULL) {
+            fprintf(fp, " <%s+0x%x>", name, offset);
+        }
+        fputc('\n', fp);
+    }
+    free(top);
+    return 0;
+}
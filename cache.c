@@ -0,0 +1,341 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "cache.h"
+#include "simulator.h"
+
+/* Each level is an array of nb_sets * assoc line entries, (line number + 1)
+ * << 1 | dirty bit, 0 for an empty way. Ways are kept in replacement order:
+ * most recently used (LRU) or filled (FIFO) first, so the victim is always
+ * the last way and a hit on the first one changes nothing. Lines are
+ * allocated on write misses too, and dirty lines evicted from L1D are
+ * written to L2 (or memory) without stalling, as a write buffer would.
+ */
+struct Cache {
+    struct CacheConfig config;
+    uint32_t line_bits;
+    uint32_t set_mask;
+    uint32_t *lines;
+    uint32_t random; ///> xorshift state of CACHE_RANDOM
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t writebacks; ///> dirty lines evicted
+};
+
+struct CacheModel {
+    struct CacheModelConfig config;
+    struct Cache l1i, l1d, l2;
+    uint32_t fetch_line; ///> line number + 1 of the last fetch, 0 if none
+    uint64_t stall_cycles; ///> cycles lost to misses
+};
+
+static const char * const policy_names[] = {"lru", "fifo", "random"};
+
+void cache_default_config(struct CacheModelConfig *config)
+{
+    config->l1i = (struct CacheConfig) {16 << 10, 4, 32, CACHE_LRU};
+    config->l1d = (struct CacheConfig) {16 << 10, 4, 32, CACHE_LRU};
+    config->l2 = (struct CacheConfig) {256 << 10, 8, 64, CACHE_LRU};
+    config->has_l2 = true;
+    config->l2_latency = 10;
+    config->mem_latency = 100;
+}
+
+static bool power_of_2(uint32_t value)
+{
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+/** Parse <size>[k|m]:<ways>:<line>[:policy] into level.
+ * \return false if malformed
+ */
+static bool parse_level(const char *spec, struct CacheConfig *level)
+{
+    char *end;
+    unsigned long size = strtoul(spec, &end, 0);
+    if (*end == 'k' || *end == 'K') {
+        size <<= 10;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        size <<= 20;
+        end++;
+    }
+    if (*end != ':') {
+        return false;
+    }
+    unsigned long assoc = strtoul(end + 1, &end, 0);
+    if (*end != ':') {
+        return false;
+    }
+    unsigned long line_size = strtoul(end + 1, &end, 0);
+    enum CachePolicy policy = CACHE_LRU;
+    if (*end == ':') {
+        end++;
+        int i = 0;
+        while (i < 3 && strcmp(end, policy_names[i]) != 0) {
+            i++;
+        }
+        if (i == 3) {
+            return false;
+        }
+        policy = i;
+    } else if (*end != '\0') {
+        return false;
+    }
+    if (size > (1ul << 30) || !power_of_2(size) || !power_of_2(assoc) ||
+        assoc > CACHE_MAX_ASSOC || !power_of_2(line_size) || line_size < 4 ||
+        size < assoc * line_size) {
+        return false;
+    }
+    *level = (struct CacheConfig) {size, assoc, line_size, policy};
+    return true;
+}
+
+int cache_parse_option(struct CacheModelConfig *config, const char *option)
+{
+    bool ok;
+    char *end;
+    if (strncmp(option, "l1i=", 4) == 0) {
+        ok = parse_level(option + 4, &config->l1i);
+    } else if (strncmp(option, "l1d=", 4) == 0) {
+        ok = parse_level(option + 4, &config->l1d);
+    } else if (strcmp(option, "l2=off") == 0) {
+        config->has_l2 = false;
+        ok = true;
+    } else if (strncmp(option, "l2=", 3) == 0) {
+        ok = parse_level(option + 3, &config->l2);
+        config->has_l2 = true;
+    } else if (strncmp(option, "l2lat=", 6) == 0) {
+        config->l2_latency = strtoul(option + 6, &end, 0);
+        ok = end != option + 6 && *end == '\0';
+    } else if (strncmp(option, "mem=", 4) == 0) {
+        config->mem_latency = strtoul(option + 4, &end, 0);
+        ok = end != option + 4 && *end == '\0';
+    } else {
+        ok = false;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: Bad cache option %s, levels are <size>:<ways>:<line>[:lru|fifo|random] "
+                "with powers of 2, at most %d ways and lines of 4 bytes or more\n",
+                option, CACHE_MAX_ASSOC);
+        return -1;
+    }
+    return 0;
+}
+
+static bool init_level(struct Cache *cache, const struct CacheConfig *config)
+{
+    cache->config = *config;
+    cache->line_bits = __builtin_ctz(config->line_size);
+    cache->set_mask = config->size / config->line_size / config->assoc - 1;
+    cache->lines = calloc(config->size / config->line_size, sizeof(uint32_t));
+    cache->random = 0x9e3779b9;
+    return cache->lines != NULL;
+}
+
+int cache_start(struct Simulator *sim, const struct CacheModelConfig *config)
+{
+    cache_stop(sim);
+    struct CacheModel *model = calloc(1, sizeof(struct CacheModel));
+    if (model == NULL || !init_level(&model->l1i, &config->l1i) ||
+        !init_level(&model->l1d, &config->l1d) ||
+        (config->has_l2 && !init_level(&model->l2, &config->l2))) {
+        fprintf(stderr, "Error: Out of memory for the cache model\n");
+        if (model != NULL) {
+            free(model->l1i.lines);
+            free(model->l1d.lines);
+            free(model->l2.lines);
+        }
+        free(model);
+        return -1;
+    }
+    model->config = *config;
+    sim->caches = model;
+    return 0;
+}
+
+void cache_stop(struct Simulator *sim)
+{
+    struct CacheModel *model = sim->caches;
+    if (model == NULL) {
+        return;
+    }
+    free(model->l1i.lines);
+    free(model->l1d.lines);
+    free(model->l2.lines);
+    free(model);
+    sim->caches = NULL;
+}
+
+/** Look address up in cache, filling its line on a miss.
+ * \param writeback set to an address of the dirty line evicted, if any
+ * \return true on a hit
+ */
+static inline bool access_line(struct Cache *cache, uint32_t address, bool write,
+                               bool *evicted_dirty, uint32_t *writeback)
+{
+    uint32_t line = address >> cache->line_bits;
+    uint32_t key = (line + 1) << 1;
+    uint32_t assoc = cache->config.assoc;
+    uint32_t *ways = cache->lines + (line & cache->set_mask) * assoc;
+    uint32_t empty = assoc;
+    for (uint32_t i = 0; i < assoc; i++) {
+        if ((ways[i] & ~1u) == key) {
+            cache->hits++;
+            uint32_t entry = ways[i] | write;
+            if (cache->config.policy == CACHE_LRU) {
+                memmove(ways + 1, ways, i * sizeof(uint32_t));
+                ways[0] = entry;
+            } else {
+                ways[i] = entry;
+            }
+            return true;
+        }
+        if (ways[i] == 0 && empty == assoc) {
+            empty = i;
+        }
+    }
+    cache->misses++;
+    uint32_t victim = assoc - 1;
+    if (cache->config.policy == CACHE_RANDOM) {
+        if (empty < assoc) {
+            victim = empty;
+        } else {
+            cache->random ^= cache->random << 13;
+            cache->random ^= cache->random >> 17;
+            cache->random ^= cache->random << 5;
+            victim = cache->random & (assoc - 1);
+        }
+    }
+    if (ways[victim] & 1) {
+        cache->writebacks++;
+        *evicted_dirty = true;
+        *writeback = ((ways[victim] >> 1) - 1) << cache->line_bits;
+    }
+    if (cache->config.policy == CACHE_RANDOM) {
+        ways[victim] = key | write;
+    } else {
+        memmove(ways + 1, ways, victim * sizeof(uint32_t));
+        ways[0] = key | write;
+    }
+    return false;
+}
+
+/** Fetch the line of address into a first level which missed it */
+static void fill_from_l2(struct CacheModel *model, uint32_t address)
+{
+    bool evicted_dirty = false;
+    uint32_t writeback;
+    if (!model->config.has_l2) {
+        model->stall_cycles += model->config.mem_latency;
+        return;
+    }
+    model->stall_cycles += model->config.l2_latency;
+    if (!access_line(&model->l2, address, false, &evicted_dirty, &writeback)) {
+        model->stall_cycles += model->config.mem_latency;
+    }
+}
+
+void cache_fetch(struct CacheModel *model, uint32_t address)
+{
+    struct Cache *l1i = &model->l1i;
+    uint32_t line = (address >> l1i->line_bits) + 1;
+    if (line == model->fetch_line) { // still first in its set
+        l1i->hits++;
+        return;
+    }
+    model->fetch_line = line;
+    bool evicted_dirty = false;
+    uint32_t writeback;
+    if (!access_line(l1i, address, false, &evicted_dirty, &writeback)) {
+        fill_from_l2(model, address);
+    }
+}
+
+void cache_data(struct CacheModel *model, uint32_t address, uint32_t size, bool write)
+{
+    struct Cache *l1d = &model->l1d;
+    uint32_t last = address + size - 1;
+    for (;;) {
+        bool evicted_dirty = false;
+        uint32_t writeback;
+        if (!access_line(l1d, address, write, &evicted_dirty, &writeback)) {
+            fill_from_l2(model, address);
+        }
+        if (evicted_dirty && model->config.has_l2) {
+            bool l2_evicted_dirty = false;
+            uint32_t l2_writeback;
+            access_line(&model->l2, writeback, true, &l2_evicted_dirty, &l2_writeback);
+        }
+        // an unaligned access may straddle two lines
+        if ((address >> l1d->line_bits) == (last >> l1d->line_bits)) {
+            return;
+        }
+        address = last;
+    }
+}
+
+void cache_invalidate(struct CacheModel *model)
+{
+    struct Cache *levels[] = {&model->l1i, &model->l1d, &model->l2};
+    for (int i = 0; i < 3; i++) {
+        if (levels[i]->lines != NULL) {
+            memset(levels[i]->lines, 0,
+                   levels[i]->config.size / levels[i]->config.line_size * sizeof(uint32_t));
+        }
+    }
+    model->fetch_line = 0;
+}
+
+uint64_t cache_stall_cycles(const struct CacheModel *model)
+{
+    return model->stall_cycles;
+}
+
+void cache_reset_counts(struct CacheModel *model)
+{
+    struct Cache *levels[] = {&model->l1i, &model->l1d, &model->l2};
+    for (int i = 0; i < 3; i++) {
+        levels[i]->hits = 0;
+        levels[i]->misses = 0;
+        levels[i]->writebacks = 0;
+    }
+    model->stall_cycles = 0;
+}
+
+/** Print the statistics of one level, names starting with prefix */
+static void print_level(FILE *fp, const struct Cache *cache, const char *prefix,
+                        enum StatsFormat format)
+{
+    char name[48];
+    const struct CacheConfig *config = &cache->config;
+    uint64_t accesses = cache->hits + cache->misses;
+    if (format == STATS_TEXT) {
+        fprintf(fp, "  %s: %u bytes, %u-way, %u byte lines, %s\n", prefix, config->size,
+                config->assoc, config->line_size, policy_names[config->policy]);
+    }
+    snprintf(name, sizeof(name), "%s_accesses", prefix);
+    stats_print_count(fp, format, name, accesses);
+    snprintf(name, sizeof(name), "%s_misses", prefix);
+    stats_print_count(fp, format, name, cache->misses);
+    snprintf(name, sizeof(name), "%s_miss_rate", prefix);
+    stats_print_real(fp, format, name, accesses > 0 ? 100.0 * cache->misses / accesses : 0);
+    snprintf(name, sizeof(name), "%s_writebacks", prefix);
+    stats_print_count(fp, format, name, cache->writebacks);
+}
+
+void cache_print_stats(FILE *fp, const struct CacheModel *model, enum StatsFormat format)
+{
+    print_level(fp, &model->l1i, "cache_l1i", format);
+    print_level(fp, &model->l1d, "cache_l1d", format);
+    if (model->config.has_l2) {
+        print_level(fp, &model->l2, "cache_l2", format);
+    }
+    // one cycle per instruction plus the misses, a fetch per instruction
+    uint64_t nb_instr = model->l1i.hits + model->l1i.misses;
+    uint64_t cycles = nb_instr + model->stall_cycles;
+    stats_print_count(fp, format, "cache_stall_cycles", model->stall_cycles);
+    stats_print_count(fp, format, "cache_cycles", cycles);
+    stats_print_real(fp, format, "cache_cpi", nb_instr > 0 ? (double) cycles / nb_instr : 0);
+}
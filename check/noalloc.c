@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "sim.h"
+
+/* noalloc runs each program it is given to completion on every engine and
+ * fails if any of the runs touched the heap. It is linked with
+ * -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc, so every allocation the
+ * simulator makes goes through the counting wrappers below.
+ */
+
+#define BUDGET 1000000000
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static bool counting; ///> true during runs
+static uint64_t nb_allocs; ///> allocations while counting
+
+void *__wrap_malloc(size_t size)
+{
+    nb_allocs += counting;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nb, size_t size)
+{
+    nb_allocs += counting;
+    return __real_calloc(nb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    nb_allocs += counting;
+    return __real_realloc(ptr, size);
+}
+
+static const char *engine_names[] = {"interp", "blocks", "jit"};
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Run as %s program...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    struct Simulator *sim = sim_create();
+    if (sim == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    int ret = EXIT_SUCCESS;
+    for (int i = 1; i < argc; i++) {
+        for (int engine = 0; engine < 3; engine++) {
+            if (sim_load_program(sim, argv[i]) < 0) {
+                ret = EXIT_FAILURE;
+                continue;
+            }
+            nb_allocs = 0;
+            counting = true;
+            uint64_t nb_instr;
+            switch (engine) {
+                case 1: nb_instr = sim_cpu_run_blocks(sim, BUDGET); break;
+                case 2: nb_instr = sim_cpu_run_jit(sim, BUDGET); break;
+                default: nb_instr = sim_cpu_run(sim, BUDGET); break;
+            }
+            counting = false;
+            printf("%s %s: %llu instructions, %llu allocations\n", argv[i],
+                   engine_names[engine], (unsigned long long) nb_instr,
+                   (unsigned long long) nb_allocs);
+            if (nb_allocs != 0) {
+                ret = EXIT_FAILURE;
+            }
+        }
+    }
+    sim_destroy(sim);
+    return ret;
+}
@@ -0,0 +1,348 @@
+#define _DEFAULT_SOURCE // for MAP_FIXED and fstat
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "checkpoint.h"
+#include "simulator.h"
+
+/* A checkpoint file is, all integers little-endian:
+ *
+ *     header      CHECKPOINT_HEADER_SIZE bytes, see the CKPT_* offsets
+ *     page table  nb_pages entries of {u32 guest address, u32 stored size,
+ *                 u64 file offset}, by increasing address
+ *     pages       uncompressed: MEM_PAGE_SIZE bytes each, at offsets aligned
+ *                 to MEM_PAGE_SIZE so they can be mapped straight from the
+ *                 file; compressed: zlib streams back to back, a page which
+ *                 does not shrink is stored as is, size MEM_PAGE_SIZE
+ *
+ * Only pages written since initialization and not all zeros are saved.
+ * Readers reject other versions, a format change must bump it.
+ */
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_COMPRESSED 0x1 ///> flag, pages are deflated
+
+#define CKPT_VERSION 8
+#define CKPT_FLAGS 12
+#define CKPT_PAGE_SIZE 16
+#define CKPT_NB_PAGES 20
+#define CKPT_REGS 24
+#define CKPT_CPSR (CKPT_REGS + 4 * NB_REGS)
+#define CKPT_FAULT_ADDRESS (CKPT_CPSR + 4)
+#define CKPT_HALTED (CKPT_FAULT_ADDRESS + 4)
+#define CKPT_FAULTED (CKPT_HALTED + 1)
+#define CHECKPOINT_HEADER_SIZE (CKPT_FAULTED + 3)
+#define CHECKPOINT_ENTRY_SIZE 16
+
+static void put_32(uint8_t *p, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) {
+        p[i] = value >> (8 * i);
+    }
+}
+
+static void put_64(uint8_t *p, uint64_t value)
+{
+    put_32(p, (uint32_t) value);
+    put_32(p + 4, (uint32_t) (value >> 32));
+}
+
+static uint32_t get_32(const uint8_t *p)
+{
+    return (uint32_t) p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint64_t get_64(const uint8_t *p)
+{
+    return get_32(p) | (uint64_t) get_32(p + 4) << 32;
+}
+
+static bool page_written(const struct Simulator *sim, uint32_t address)
+{
+    uint32_t page = address >> MEM_PAGE_BITS;
+    return (sim->written[page / 8] >> (page % 8)) & 1;
+}
+
+static bool page_is_zero(const uint8_t *page)
+{
+    uint64_t bits = 0;
+    for (int i = 0; i < MEM_PAGE_SIZE; i += 8) {
+        uint64_t word;
+        memcpy(&word, page + i, 8);
+        bits |= word;
+    }
+    return bits == 0;
+}
+
+/** Collect the addresses of the pages a checkpoint of sim holds.
+ * \return number of pages, *pages to be freed, -1 if out of memory
+ */
+static int64_t collect_pages(const struct Simulator *sim, uint32_t **pages)
+{
+    size_t capacity = 0;
+    int64_t nb_pages = 0;
+    *pages = NULL;
+    for (int i = 0; i < NB_REGIONS; i++) {
+        const struct MemoryRegion *region = &sim->mem_region[i];
+        for (uint32_t offset = 0; offset < region->size; offset += MEM_PAGE_SIZE) {
+            uint32_t address = region->start + offset;
+            if (!page_written(sim, address) || page_is_zero(sim->mem_base + address)) {
+                continue;
+            }
+            if ((size_t) nb_pages == capacity) {
+                capacity = capacity ? 2 * capacity : 256;
+                uint32_t *grown = realloc(*pages, capacity * sizeof(uint32_t));
+                if (grown == NULL) {
+                    free(*pages);
+                    return -1;
+                }
+                *pages = grown;
+            }
+            (*pages)[nb_pages++] = address;
+        }
+    }
+    return nb_pages;
+}
+
+/** Saves started by this process, names their temporary files */
+static unsigned nb_saves;
+
+int checkpoint_save(const struct Simulator *sim, const char *fname, bool compress)
+{
+    uint32_t *pages;
+    int64_t nb_pages = collect_pages(sim, &pages);
+    if (nb_pages < 0) {
+        fprintf(stderr, "Error: Out of memory writing checkpoint %s\n", fname);
+        return -1;
+    }
+    size_t table_size = nb_pages * CHECKPOINT_ENTRY_SIZE;
+    uint8_t *table = malloc(table_size + 1);
+    uint8_t *buf = malloc(compressBound(MEM_PAGE_SIZE));
+    // written next to fname then renamed over it: sim may be resumed from
+    // fname, its pages still mapped from the file
+    char *tmp_name = malloc(strlen(fname) + 32);
+    FILE *fp = NULL;
+    int ret = -1;
+    if (table == NULL || buf == NULL || tmp_name == NULL) {
+        fprintf(stderr, "Error: Out of memory writing checkpoint %s\n", fname);
+        goto out;
+    }
+    // unique per process and save, the mode goes through the umask like fopen()
+    int fd = -1;
+    for (int attempt = 0; fd < 0 && attempt < 16; attempt++) {
+        sprintf(tmp_name, "%s.%ld.%u", fname, (long) getpid(),
+                __atomic_add_fetch(&nb_saves, 1, __ATOMIC_RELAXED));
+        fd = open(tmp_name, O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if (fd < 0 && errno != EEXIST) {
+            break;
+        }
+    }
+    if (fd >= 0) {
+        fp = fdopen(fd, "wb");
+        if (fp == NULL) {
+            close(fd);
+            unlink(tmp_name);
+        }
+    }
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Could not open file %s\n", fname);
+        goto out;
+    }
+
+    uint8_t header[CHECKPOINT_HEADER_SIZE] = {0};
+    memcpy(header, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_SIZE);
+    put_32(header + CKPT_VERSION, CHECKPOINT_VERSION);
+    put_32(header + CKPT_FLAGS, compress ? CHECKPOINT_COMPRESSED : 0);
+    put_32(header + CKPT_PAGE_SIZE, MEM_PAGE_SIZE);
+    put_32(header + CKPT_NB_PAGES, nb_pages);
+    for (int i = 0; i < NB_REGS; i++) {
+        put_32(header + CKPT_REGS + 4 * i, sim->cpu.regs[i]);
+    }
+    put_32(header + CKPT_CPSR, sim->cpu.CPSR);
+    put_32(header + CKPT_FAULT_ADDRESS, sim->cpu.fault_address);
+    header[CKPT_HALTED] = sim->cpu.halted;
+    header[CKPT_FAULTED] = sim->cpu.faulted;
+
+    // the table is written last, once the stored sizes are known
+    uint64_t offset = CHECKPOINT_HEADER_SIZE + table_size;
+    if (!compress) {
+        offset = (offset + MEM_PAGE_SIZE - 1) / MEM_PAGE_SIZE * MEM_PAGE_SIZE;
+    }
+    if (fseek(fp, offset, SEEK_SET) < 0) {
+        goto io_error;
+    }
+    for (int64_t i = 0; i < nb_pages; i++) {
+        const uint8_t *data = sim->mem_base + pages[i];
+        uLongf size = MEM_PAGE_SIZE;
+        if (compress) {
+            size = compressBound(MEM_PAGE_SIZE);
+            if (compress2(buf, &size, data, MEM_PAGE_SIZE, Z_BEST_SPEED) == Z_OK &&
+                size < MEM_PAGE_SIZE) {
+                data = buf;
+            } else {
+                size = MEM_PAGE_SIZE;
+            }
+        }
+        if (fwrite(data, 1, size, fp) != size) {
+            goto io_error;
+        }
+        uint8_t *entry = table + i * CHECKPOINT_ENTRY_SIZE;
+        put_32(entry, pages[i]);
+        put_32(entry + 4, size);
+        put_64(entry + 8, offset);
+        offset += size;
+    }
+    if (fseek(fp, 0, SEEK_SET) < 0 ||
+        fwrite(header, 1, sizeof(header), fp) != sizeof(header) ||
+        fwrite(table, 1, table_size, fp) != table_size) {
+        goto io_error;
+    }
+    ret = 0;
+    goto out;
+io_error:
+    fprintf(stderr, "Error: Could not write checkpoint %s\n", fname);
+out:
+    if (fp != NULL) {
+        if ((fclose(fp) != 0 || rename(tmp_name, fname) < 0) && ret == 0) {
+            fprintf(stderr, "Error: Could not write checkpoint %s\n", fname);
+            ret = -1;
+        }
+        if (ret < 0) {
+            unlink(tmp_name);
+        }
+    }
+    free(tmp_name);
+    free(buf);
+    free(table);
+    free(pages);
+    return ret;
+}
+
+/** Bring the page of entry from the checkpoint mapped at data into sim.
+ * \param run number of pages following entry which are stored raw, right
+ *        after each other in memory and in the file, mapped in one go
+ * \return 0 on success, -1 if the page is corrupt
+ */
+static int resume_pages(struct Simulator *sim, int fd, const uint8_t *data,
+                        uint32_t address, uint32_t size, uint64_t offset, uint32_t run)
+{
+    uint8_t *dest = sim->mem_base + address;
+    if (size == MEM_PAGE_SIZE) {
+        if (offset % MEM_PAGE_SIZE == 0 && sysconf(_SC_PAGESIZE) == MEM_PAGE_SIZE &&
+            mmap(dest, (size_t) run * MEM_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_FIXED, fd, offset) != MAP_FAILED) {
+            return 0;
+        }
+        memcpy(dest, data + offset, (size_t) run * MEM_PAGE_SIZE);
+        return 0;
+    }
+    uLongf length = MEM_PAGE_SIZE;
+    if (uncompress(dest, &length, data + offset, size) != Z_OK || length != MEM_PAGE_SIZE) {
+        return -1;
+    }
+    return 0;
+}
+
+int checkpoint_resume(struct Simulator *sim, const char *fname)
+{
+    int fd = open(fname, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "Error: Could not open file %s\n", fname);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    uint64_t file_size = st.st_size;
+    const uint8_t *data = MAP_FAILED;
+    if (file_size >= CHECKPOINT_HEADER_SIZE) {
+        data = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    if (data == MAP_FAILED || memcmp(data, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_SIZE) != 0) {
+        fprintf(stderr, "Error: %s is not a checkpoint\n", fname);
+        if (data != MAP_FAILED) {
+            munmap((void *) data, file_size);
+        }
+        close(fd);
+        return -1;
+    }
+
+    int ret = -1;
+    uint32_t nb_pages = get_32(data + CKPT_NB_PAGES);
+    uint32_t flags = get_32(data + CKPT_FLAGS);
+    if (get_32(data + CKPT_VERSION) != CHECKPOINT_VERSION ||
+        get_32(data + CKPT_PAGE_SIZE) != MEM_PAGE_SIZE || (flags & ~CHECKPOINT_COMPRESSED)) {
+        fprintf(stderr, "Error: %s: Unsupported checkpoint version\n", fname);
+        goto out;
+    }
+    const uint8_t *table = data + CHECKPOINT_HEADER_SIZE;
+    if ((file_size - CHECKPOINT_HEADER_SIZE) / CHECKPOINT_ENTRY_SIZE < nb_pages) {
+        goto corrupt;
+    }
+    for (uint32_t i = 0; i < nb_pages; i++) {
+        const uint8_t *entry = table + i * CHECKPOINT_ENTRY_SIZE;
+        uint32_t address = get_32(entry);
+        uint32_t size = get_32(entry + 4);
+        uint64_t offset = get_64(entry + 8);
+        if (address % MEM_PAGE_SIZE != 0 || !sim_mem_mapped(sim, address) ||
+            !sim_mem_mapped(sim, address + MEM_PAGE_SIZE - 1) ||
+            size == 0 || size > MEM_PAGE_SIZE || offset > file_size ||
+            size > file_size - offset) {
+            goto corrupt;
+        }
+    }
+
+    // from here on, failing leaves sim reinitialized
+    ret = -2;
+    if (sim_initialize(sim) < 0) {
+        fprintf(stderr, "Error: Could not map guest memory\n");
+        goto out;
+    }
+    for (uint32_t i = 0; i < nb_pages; ) {
+        const uint8_t *entry = table + i * CHECKPOINT_ENTRY_SIZE;
+        uint32_t address = get_32(entry);
+        uint32_t size = get_32(entry + 4);
+        uint64_t offset = get_64(entry + 8);
+        uint32_t run = 1;
+        // raw pages contiguous in both memory and file are mapped together
+        while (size == MEM_PAGE_SIZE && i + run < nb_pages) {
+            const uint8_t *next = entry + run * CHECKPOINT_ENTRY_SIZE;
+            if (get_32(next) != address + run * MEM_PAGE_SIZE || get_32(next + 4) != MEM_PAGE_SIZE ||
+                get_64(next + 8) != offset + (uint64_t) run * MEM_PAGE_SIZE) {
+                break;
+            }
+            run++;
+        }
+        if (resume_pages(sim, fd, data, address, size, offset, run) < 0) {
+            sim_initialize(sim);
+            goto corrupt;
+        }
+        for (uint32_t j = 0; j < run; j++) {
+            uint32_t page = (address >> MEM_PAGE_BITS) + j;
+            sim->written[page / 8] |= 1 << (page % 8);
+        }
+        i += run;
+    }
+    for (int i = 0; i < NB_REGS; i++) {
+        sim->cpu.regs[i] = get_32(data + CKPT_REGS + 4 * i);
+    }
+    sim->cpu.CPSR = get_32(data + CKPT_CPSR);
+    sim->cpu.fault_address = get_32(data + CKPT_FAULT_ADDRESS);
+    sim->cpu.halted = data[CKPT_HALTED];
+    sim->cpu.faulted = data[CKPT_FAULTED];
+    ret = 0;
+    goto out;
+corrupt:
+    fprintf(stderr, "Error: %s: Corrupt checkpoint\n", fname);
+out:
+    munmap((void *) data, file_size);
+    close(fd);
+    return ret;
+}
@@ -0,0 +1,132 @@
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "dump.h"
+#include "simulator.h"
+
+#define DUMP_BUF_SIZE (1 << 16)
+#define DUMP_LINE_SIZE 19 ///> "aaaaaaaa: wwwwwwww\n"
+
+struct DumpBuffer {
+    int fd;
+    size_t used;
+    int error; ///> set once a write failed, later output is dropped
+    char data[DUMP_BUF_SIZE];
+};
+
+/** Write size bytes to buf->fd, retrying short writes */
+static void write_all(struct DumpBuffer *buf, const void *data, size_t size)
+{
+    const char *p = data;
+    while (size > 0 && !buf->error) {
+        ssize_t nb_written = write(buf->fd, p, size);
+        if (nb_written < 0 && errno != EINTR) {
+            buf->error = 1;
+        } else if (nb_written > 0) {
+            p += nb_written;
+            size -= nb_written;
+        }
+    }
+}
+
+static void flush(struct DumpBuffer *buf)
+{
+    write_all(buf, buf->data, buf->used);
+    buf->used = 0;
+}
+
+/** Format value as 8 lower case hex digits at p */
+static inline void put_hex(char *p, uint32_t value)
+{
+    static const char digits[16] = "0123456789abcdef";
+    for (int i = 7; i >= 0; i--) {
+        p[i] = digits[value & 0xf];
+        value >>= 4;
+    }
+}
+
+static inline bool page_written(const struct Simulator *sim, uint32_t address)
+{
+    uint32_t page = address >> MEM_PAGE_BITS;
+    return (sim->written[page / 8] >> (page % 8)) & 1;
+}
+
+/** Append the hex lines of words low_addr to last_addr to buf */
+static void dump_hex(struct DumpBuffer *buf, const struct Simulator *sim, uint32_t low_addr,
+                     uint32_t last_addr, bool nonzero)
+{
+    for (uint64_t addr = low_addr; addr <= last_addr; addr += 4) {
+        if (nonzero && !page_written(sim, addr)) {
+            // never written, so all zeros: skip the words lying wholly in it
+            uint64_t page_end = (addr | (MEM_PAGE_SIZE - 1)) + 1;
+            if (addr + 4 <= page_end) {
+                addr += (page_end - addr) / 4 * 4 - 4;
+                continue;
+            }
+        }
+        const uint8_t *host = sim->mem_base + addr;
+        uint32_t word = (uint32_t) host[0] << 24 | host[1] << 16 | host[2] << 8 | host[3];
+        if (nonzero && word == 0) {
+            continue;
+        }
+        if (buf->used + DUMP_LINE_SIZE > DUMP_BUF_SIZE) {
+            flush(buf);
+        }
+        char *line = buf->data + buf->used;
+        put_hex(line, addr);
+        line[8] = ':';
+        line[9] = ' ';
+        put_hex(line + 10, word);
+        line[18] = '\n';
+        buf->used += DUMP_LINE_SIZE;
+    }
+}
+
+int dump_memory(FILE *fp, const struct Simulator *sim, uint32_t low_addr,
+                uint32_t high_addr, enum DumpMode mode, uint32_t *bad_addr)
+{
+    // only the region holding low_addr can be dumped, the rest is unmapped
+    const struct MemoryRegion *region = NULL;
+    for (int i = 0; i < NB_REGIONS; i++) {
+        if (low_addr - sim->mem_region[i].start < sim->mem_region[i].size) {
+            region = &sim->mem_region[i];
+        }
+    }
+    if (low_addr > high_addr) {
+        return 0;
+    }
+    uint64_t region_end = region ? (uint64_t) region->start + region->size : 0;
+    if (region == NULL || low_addr + UINT64_C(4) > region_end) {
+        *bad_addr = low_addr;
+        return -1;
+    }
+    // last word wholly inside the region
+    uint32_t last_addr = low_addr + (region_end - 4 - low_addr) / 4 * 4;
+    bool truncated = high_addr > last_addr;
+    if (!truncated) {
+        last_addr = high_addr;
+    }
+
+    struct DumpBuffer buf;
+    fflush(fp);
+    buf.fd = fileno(fp);
+    buf.used = 0;
+    buf.error = 0;
+    if (mode == DUMP_BINARY) {
+        // last_addr is a whole number of words from low_addr
+        uint32_t last_word = low_addr + (last_addr - low_addr) / 4 * 4;
+        write_all(&buf, sim->mem_base + low_addr, (size_t) last_word - low_addr + 4);
+    } else {
+        dump_hex(&buf, sim, low_addr, last_addr, mode == DUMP_NONZERO);
+        flush(&buf);
+    }
+    if (buf.error) {
+        return -2;
+    }
+    if (truncated) {
+        *bad_addr = low_addr + ((uint64_t) last_addr - low_addr) / 4 * 4 + 4;
+        return -1;
+    }
+    return 0;
+}
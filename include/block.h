@@ -0,0 +1,50 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sim.h"
+#include "isa.h"
+
+struct BlockCache;
+
+/** Longest basic block, longer straight-line code is split */
+#define BLOCK_MAX_INSTR 64
+
+/** True if instr might write PC or halt the CPU, so it ends a basic block */
+bool block_ends_with(const struct DecodedInstr *instr);
+
+/** Allocate the blocks of one simulator, all unknown yet.
+ * \return NULL if out of memory
+ */
+struct BlockCache * block_create();
+
+/** Release blocks allocated by block_create() */
+void block_destroy(struct BlockCache *cache);
+
+/** Number of instructions of the basic block starting at pc.
+ * Decodes the block's instructions as a side effect.
+ * \param sim Simulator whose text region holds the block
+ * \param pc address of first instruction, in the text region
+ */
+uint32_t block_length(struct Simulator *sim, uint32_t pc);
+
+/** Process instructions like process_instructions(), but a basic block at a
+ * time. Each block remembers the blocks it exited to, so following them costs
+ * no lookup, and PC and the halted bit are only looked at between blocks.
+ * \param sim Simulator, its CPU state is updated in place
+ * \param max_instr maximum number of instructions to execute
+ * \return number of instructions executed
+ */
+uint64_t block_run(struct Simulator *sim, uint64_t max_instr);
+
+/** Notify the block engine of a write to the text region.
+ * If the word belongs to a known block all blocks get dropped.
+ * \param address address written to
+ */
+void block_invalidate(struct Simulator *sim, uint32_t address);
+
+/** Drop all blocks, e.g. when a new program gets loaded */
+void block_flush(struct Simulator *sim);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef BPRED_H
+#define BPRED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "sim.h"
+#include "isa.h"
+#include "stats.h"
+
+struct BranchPredictor;
+
+/** Branch prediction scheme */
+enum BranchPredictorKind {
+    BPRED_NOT_TAKEN, ///> static, every branch predicted not taken
+    BPRED_BIMODAL, ///> 2-bit counters indexed by PC
+    BPRED_GSHARE, ///> 2-bit counters indexed by PC xor the global history
+    BPRED_BTB, ///> branch target buffer, taken if it holds the branch with a taken 2-bit counter
+};
+
+struct BranchPredictorConfig {
+    enum BranchPredictorKind kind;
+    uint32_t entries; ///> counters or BTB entries, a power of 2
+    uint32_t history_bits; ///> global history length of gshare
+};
+
+/** Fill config with the default predictor: bimodal, 4096 entries, and 12
+ * history bits for gshare
+ */
+void bpred_default_config(struct BranchPredictorConfig *config);
+
+/** Apply one option to config: not-taken, bimodal, gshare, btb, entries=<n>
+ * or history=<bits>.
+ * \return 0 on success, -1 after printing an error
+ */
+int bpred_parse_option(struct BranchPredictorConfig *config, const char *option);
+
+/** Start predicting the branches of sim, with a cold predictor and zeroed
+ * counts. Runs of sim go through observe_run() until bpred_stop().
+ * \return 0 on success, -1 after printing an error
+ */
+int bpred_start(struct Simulator *sim, const struct BranchPredictorConfig *config);
+
+/** Stop predicting branches of sim */
+void bpred_stop(struct Simulator *sim);
+
+/** Predict the B or BL instr @ pc about to execute on sim, then train the
+ * predictor with the actual outcome.
+ * \return true if the prediction was wrong
+ */
+bool bpred_branch(struct Simulator *sim, uint32_t pc, const struct DecodedInstr *instr);
+
+/** Zero the counts, the predictor keeps what it learnt */
+void bpred_reset_counts(struct BranchPredictor *predictor);
+
+/** Print the aggregate branch counts and misprediction rate, as stats_print()
+ * does
+ */
+void bpred_print_stats(FILE *fp, const struct BranchPredictor *predictor, enum StatsFormat format);
+
+/** Print the nb_top branches of sim with the most mispredictions.
+ * \return 0 on success, -1 if branches of sim are not predicted
+ */
+int bpred_report(const struct Simulator *sim, FILE *fp, uint32_t nb_top);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "sim.h"
+#include "stats.h"
+
+struct CacheModel;
+
+/** Line picked for eviction when a set is full */
+enum CachePolicy {
+    CACHE_LRU, ///> least recently used
+    CACHE_FIFO, ///> least recently filled
+    CACHE_RANDOM, ///> any, from a fixed-seed generator so runs repeat
+};
+
+/** Geometry of one cache level, sizes in bytes and powers of 2 */
+struct CacheConfig {
+    uint32_t size;
+    uint32_t assoc; ///> ways per set, at most CACHE_MAX_ASSOC
+    uint32_t line_size; ///> at least 4
+    enum CachePolicy policy;
+};
+
+#define CACHE_MAX_ASSOC 32
+
+/** Configuration of the whole hierarchy: split L1, optional unified L2 */
+struct CacheModelConfig {
+    struct CacheConfig l1i, l1d, l2;
+    bool has_l2;
+    uint32_t l2_latency; ///> cycles an L1 miss hitting in L2 costs
+    uint32_t mem_latency; ///> cycles a miss of the last level costs
+};
+
+/** Fill config with the default hierarchy: 16 KiB 4-way L1I and L1D with 32
+ * byte lines, a 256 KiB 8-way L2 with 64 byte lines, all LRU, 10 cycles to L2
+ * and 100 to memory.
+ */
+void cache_default_config(struct CacheModelConfig *config);
+
+/** Apply one option to config: l1i=, l1d= or l2=<size>[k|m]:<ways>:<line>[:lru|fifo|random],
+ * l2=off, l2lat=<cycles> or mem=<cycles>.
+ * \return 0 on success, -1 after printing an error
+ */
+int cache_parse_option(struct CacheModelConfig *config, const char *option);
+
+/** Start modeling the caches of sim, empty, with zeroed counts.
+ * Runs of sim go through observe_run() until cache_stop().
+ * \return 0 on success, -1 after printing an error
+ */
+int cache_start(struct Simulator *sim, const struct CacheModelConfig *config);
+
+/** Stop modeling the caches of sim */
+void cache_stop(struct Simulator *sim);
+
+/** Fetch of the instruction @ address */
+void cache_fetch(struct CacheModel *model, uint32_t address);
+
+/** Load or store of size bytes @ address */
+void cache_data(struct CacheModel *model, uint32_t address, uint32_t size, bool write);
+
+/** Empty every level, e.g. when a new program gets loaded */
+void cache_invalidate(struct CacheModel *model);
+
+/** Cycles lost to misses since the counts were zeroed */
+uint64_t cache_stall_cycles(const struct CacheModel *model);
+
+/** Zero the hit and miss counts */
+void cache_reset_counts(struct CacheModel *model);
+
+/** Print the geometry, counts and estimated cycles of model, as stats_print()
+ * does
+ */
+void cache_print_stats(FILE *fp, const struct CacheModel *model, enum StatsFormat format);
+
+#endif
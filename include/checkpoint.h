@@ -0,0 +1,31 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdbool.h>
+#include "sim.h"
+
+/** First bytes of every checkpoint file */
+#define CHECKPOINT_MAGIC "ARMSIMCK"
+#define CHECKPOINT_MAGIC_SIZE 8
+
+/** Write the CPU state and the non-zero pages of memory of sim to fname.
+ * Unlike snapshots, checkpoints outlive the process.
+ * \param compress deflate each page; smaller, but resuming has to inflate
+ *        pages instead of mapping them
+ * \return 0 on success, -1 after printing an error
+ */
+int checkpoint_save(const struct Simulator *sim, const char *fname, bool compress);
+
+/** Reinitialize sim and bring it to the state saved in fname. Pages of an
+ * uncompressed checkpoint are mapped copy-on-write from the file rather than
+ * read, so resuming costs next to nothing until they are touched; the file
+ * must not change while sim uses it; checkpoint_save() replaces rather than
+ * rewrites files, so saving over it is safe.
+ * \return 0 on success, -1 after printing an error if fname is not a
+ *         checkpoint this version can resume, sim is left as it was, -2 after
+ *         printing an error if sim got reinitialized, e.g. when a page turns
+ *         out corrupt while resuming
+ */
+int checkpoint_resume(struct Simulator *sim, const char *fname);
+
+#endif
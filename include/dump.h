@@ -0,0 +1,26 @@
+#ifndef DUMP_H
+#define DUMP_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "sim.h"
+
+/** Output format of dump_memory() */
+enum DumpMode {
+    DUMP_HEX, ///> one "address: word" line per word, like mdump always did
+    DUMP_NONZERO, ///> the same lines, for words other than 0 only
+    DUMP_BINARY, ///> the raw bytes, as they are in guest memory (big-endian)
+};
+
+/** Dump the words of sim from low_addr to high_addr to fp.
+ * Output is formatted into large buffers and written with a few write()
+ * calls, after flushing fp; untouched pages are skipped without being read
+ * in DUMP_NONZERO mode.
+ * \param bad_addr set to the first word outside the memory map, if any
+ * \return 0 on success, -1 if the dump stopped at bad_addr, -2 on a write
+ *         error
+ */
+int dump_memory(FILE *fp, const struct Simulator *sim, uint32_t low_addr,
+                uint32_t high_addr, enum DumpMode mode, uint32_t *bad_addr);
+
+#endif
@@ -1,10 +1,99 @@
 #ifndef ISA_H
 #define ISA_H
 
+#include <stdint.h>
+#include "sim.h"
+
+struct DecodedInstr;
+struct Simulator;
+
+// Data processing ops, in DataProcOpcode order
+#define DP_OPS \
+    X(AND) X(EOR) X(SUB) X(RSB) X(ADD) X(ADC) X(SBC) X(RSC) \
+    X(TST) X(TEQ) X(CMP) X(CMN) X(ORR) X(MOV) X(BIC) X(MVN)
+
+// Every other op, each has a single handler
+#define OTHER_OPS \
+    X(LDR) X(STR) X(LDRB) X(STRB) X(MUL) X(MLA) X(BL) X(SWI) X(UND)
+
+#define INSTR_OPS DP_OPS OTHER_OPS
+
+/** Class of a decoded instruction, data processing ops come first */
+enum InstrOp {
+#define X(name) INSTR_##name,
+    INSTR_OPS
+#undef X
+    NB_INSTR_OPS
+};
+
+/** Instruction handler, executes an already decoded instruction on sim */
+typedef void (*InstrHandler)(struct Simulator *sim, const struct DecodedInstr *instr);
+
+/** An instruction decoded once and cached by address.
+ * Fields an instruction class does not use are left 0.
+ */
+struct DecodedInstr {
+    InstrHandler handler; ///> NULL if not decoded yet
+    uint32_t instruction; ///> Raw instruction word
+    uint8_t op; ///> enum InstrOp
+    uint16_t handler_id; ///> Index of handler variant, used by the threaded dispatcher
+    uint32_t imm; ///> Pre-rotated immediate, ld/str offset, branch offset or SWI number
+    uint8_t cond; ///> bits 31-28
+    uint8_t rd, rn, rm, rs; ///> Register ids
+    uint8_t shift_imm; ///> Shift amount of a data-processing register operand
+    uint8_t S, I, P, U, W, L; ///> Instruction bits
+    uint8_t imm_rotated; ///> 1 if the data-processing immediate has a non-zero rotation
+    uint8_t needs_flags; ///> 0 if cond is AL and the instruction does not read C
+};
+
 /** Process instruction @ PC and increment PC by 4.
- * \param state Current state of CPU
- * \return New state of CPU
+ * \param sim Simulator, its CPU state is updated in place
+ */
+void process_instruction(struct Simulator *sim);
+
+/** Process instructions until max_instr were executed or the CPU halts.
+ * Built with -DTHREADED_DISPATCH this uses the direct-threaded interpreter.
+ * \param sim Simulator, its CPU state is updated in place
+ * \param max_instr maximum number of instructions to execute
+ * \return number of instructions executed
  */
-struct CPUState process_instruction(struct CPUState state);
+uint64_t process_instructions(struct Simulator *sim, uint64_t max_instr);
+
+/** Execute an already decoded instruction on sim and increment PC by 4.
+ * Flags may be left lazy, see isa_sync_flags(). Used by translated code.
+ * \param sim Simulator, its CPU state is updated in place
+ * \param instr decoded instruction, from isa_decoded_at()
+ */
+void isa_execute_decoded(struct Simulator *sim, const struct DecodedInstr *instr);
+
+/** Execute the nb_instr instructions from address on, without fetching or
+ * looking at PC in between. They all have to be decoded already (see
+ * isa_decoded_at()) and inside the text region; execution stops early if one
+ * of them gets overwritten. Flags may be left lazy, see isa_sync_flags().
+ * \param sim Simulator, its CPU state is updated in place
+ * \param address address of first instruction
+ * \param nb_instr number of instructions
+ * \return number of instructions executed
+ */
+uint32_t isa_execute_block(struct Simulator *sim, uint32_t address, uint32_t nb_instr);
+
+/** Bring N, Z, C and V in the CPSR of sim up to date after
+ * isa_execute_decoded() or isa_execute_block()
+ */
+void isa_sync_flags(struct Simulator *sim);
+
+/** Return decoded instruction @ address, decoding it if needed.
+ * The pointer stays valid until the word gets written for text addresses.
+ */
+const struct DecodedInstr * isa_decoded_at(struct Simulator *sim, uint32_t address);
+
+/** Drop the cached decode of the instruction word containing address.
+ * Called on every write to the text region.
+ * \param address address written to
+ */
+void isa_invalidate(struct Simulator *sim, uint32_t address);
+
+/** Drop all cached decodes, e.g. when a new program gets loaded */
+void isa_flush_decode_cache(struct Simulator *sim);
 
 #endif
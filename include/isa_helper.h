@@ -5,6 +5,7 @@
 #include <stdbool.h>
 #include <limits.h>
 #include "sim.h"
+#include "isa.h"
 
 #define S_BIT 20
 
@@ -15,54 +16,82 @@
 #define P_BIT 24
 #define I_BIT 25
 
+#define COND_AL 0xE
+
+/** Kind of the last flag-setting operation */
+enum FlagsKind {
+    FLAGS_NONE, ///> nothing pending, CPSR is up to date
+    FLAGS_ADD, ///> op1 + op2 + carry, subtractions are recorded as op1 + ~op2 + carry
+    FLAGS_LOGIC, ///> N, Z from result, C = carry, V unaffected
+    FLAGS_MUL, ///> N, Z from result, C and V unaffected
+};
+
+/** Operands and result of the last flag-setting operation, so that N, Z, C
+ * and V are only computed when someone actually reads them.
+ */
+struct LazyFlags {
+    uint8_t kind; ///> enum FlagsKind
+    uint8_t carry; ///> carry in for FLAGS_ADD, shifter carry for FLAGS_LOGIC
+    uint32_t op1, op2;
+    uint32_t result;
+};
+
 struct ShifterOperand {
     uint32_t shifter_operand;
     uint8_t shifter_carry;
 };
 
-/**
- * Given instruction in ARM format, returns the shifter_operand and shifter_carry.
- *
- * @param state current state of machine, required when returning carry
- * flags or to read registers.*
- *
- * @param instruction the ARM format instruction.
- * The lowest 12 bits define the shifter operand stuff.
- *
- * @return malloc-ed pointer to a ShifterOperand struct.
- * The caller should free it after use
+/** Register and flag writes of the executing instruction. They reach the
+ * CPU state only when the instruction retires, so handlers keep reading
+ * the state as it was before the instruction.
+ */
+struct WriteBack {
+    uint8_t nb_regs; ///> Number of pending register writes
+    uint8_t reg_ids[2]; ///> At most Rd plus base register write-back
+    uint32_t reg_vals[2];
+    struct LazyFlags flags; ///> flags set by the instruction, if any
+    uint8_t halted; ///> 1 if the instruction halts the CPU
+};
+
+/** Queue write of val to register reg_id, later writes to the same
+ * register win.
  */
-struct ShifterOperand * shifter_operand(struct CPUState state, uint32_t instruction);
+static inline void wb_write_reg(struct WriteBack *wb, uint8_t reg_id, uint32_t val)
+{
+    wb->reg_ids[wb->nb_regs] = reg_id;
+    wb->reg_vals[wb->nb_regs] = val;
+    wb->nb_regs++;
+}
+
 uint32_t rotate_right(uint32_t shiftee, uint8_t shifter);
 uint32_t arithmetic_right_shift(uint32_t shiftee, uint8_t shifter);
 uint8_t get_bit(uint32_t from, uint8_t bitid);
 uint32_t get_bits(uint32_t from, uint8_t msb_id, uint8_t lsb_id);
 void set_bit(uint32_t *reg, uint8_t bit_id, uint8_t bit_val);
 
-bool check_add_carry(uint32_t a, uint32_t b);
-bool check_sub_borrow(uint32_t a, uint32_t b);
-
-/** Get overflow bit of a bitwise addition.
- * NB: if you want overflow bit for sub (op1 - op2) call function
- * like `check_overflow(op1, -op2)`
- * \param a operand1
- * \param b operand2
- * \return overflow bit (bool)
+/** Compute N, Z, C and V of a lazily recorded operation.
+ * \param cpsr CPSR before the operation, flags it leaves unaffected are kept
+ * \param flags the recorded operation
+ * \return CPSR after the operation
  */
-bool check_overflow(uint32_t a, uint32_t b);
+uint32_t materialize_flags(uint32_t cpsr, const struct LazyFlags *flags);
 
 /** Handle addr_mode and I, P, U, W operands.
  * Refer to Section A5.2 in ARM manual.
- * Note: This function might update Rn value in next_state
+ * Note: This function might queue a write of Rn
  * depending upon pre/post indexed addressing.
  * \param curr_state current state of machine
- * \param next_state pointer to next state of machine, might get modified depending
- *                   upon pre/post-indexed addressing
- * \param instruction 32-bit instruction
+ * \param wb pending writes of the instruction, might get modified depending
+ *           upon pre/post-indexed addressing
+ * \param instr decoded load/store instruction
  * \return 32-bit decoded address
  */
-uint32_t ld_str_addr_mode(struct CPUState curr_state,
-                          struct CPUState *next_state, uint32_t instruction);
+uint32_t ld_str_addr_mode(const struct CPUState *curr_state,
+                          struct WriteBack *wb,
+                          const struct DecodedInstr *instr);
+
+/** Outcome of every <cond> for every value of the NZCV flags */
+extern const uint16_t condition_table[16];
 
 /** Check if current instruction should be executed depending upon the <cond> bits
  * and CPSR state.
@@ -70,7 +99,22 @@ uint32_t ld_str_addr_mode(struct CPUState curr_state,
  * \param cond bits 31-28 in instruction
  * \return boolean, true if execute current instruction
  */
-bool condition_check(struct CPUState curr_state, uint8_t cond);
+static inline bool condition_check(const struct CPUState *curr_state, uint8_t cond)
+{
+    return (condition_table[cond] >> (curr_state->CPSR >> CPSR_V)) & 1;
+}
+
+/** True if <cond> passes whatever the flags, so the check can be skipped */
+static inline bool condition_always(uint8_t cond)
+{
+    return condition_table[cond] == 0xFFFF;
+}
+
+/** True if <cond> fails whatever the flags, so the instruction is a no-op */
+static inline bool condition_never(uint8_t cond)
+{
+    return condition_table[cond] == 0;
+}
 
 uint32_t sign_extend(uint32_t num, uint8_t curr_width, uint8_t req_width);
 
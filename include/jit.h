@@ -0,0 +1,46 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+#include "sim.h"
+
+struct JitCache;
+
+/** Times a basic block has to be entered before it gets translated */
+#define JIT_THRESHOLD 16
+
+/** Allocate the translation cache of one simulator, empty.
+ * \return NULL if out of memory
+ */
+struct JitCache * jit_create();
+
+/** Release a cache allocated by jit_create() and its translated code */
+void jit_destroy(struct JitCache *jit);
+
+/** Process instructions like process_instructions(), but translate hot basic
+ * blocks of the text region to native x86-64 code and run them from there.
+ * Blocks are the ones block_length() finds, translated blocks jump straight
+ * to each other once they have been seen to follow one another. Falls back
+ * to the interpreter for cold blocks, for anything outside the text region,
+ * and on hosts other than x86-64.
+ * \param sim Simulator, its CPU state is updated in place
+ * \param max_instr maximum number of instructions to execute
+ * \return number of instructions executed
+ */
+uint64_t jit_run(struct Simulator *sim, uint64_t max_instr);
+
+/** Notify the translator that a guest fault abandoned the current run, so
+ * that statistics only count the instructions executed before the fault.
+ */
+void jit_abandon(struct Simulator *sim);
+
+/** Notify the translator of a write to the text region.
+ * If the word belongs to a translated block all translations get dropped.
+ * \param address address written to
+ */
+void jit_invalidate(struct Simulator *sim, uint32_t address);
+
+/** Drop all translated blocks, e.g. when a new program gets loaded */
+void jit_flush(struct Simulator *sim);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "sim.h"
+
+/** Reinitialize sim and load program fname into it, an ELF file or a
+ * checkpoint (see checkpoint_resume()) if it starts like one, else a hex
+ * file. The file is mapped rather than read, and checked before sim gets
+ * reinitialized, so that a bad file leaves the program loaded before alone.
+ *
+ * Hex files hold one 32-bit word per line, loaded into the text region from
+ * its start. Lines hold 1 to 8 hex digits, optionally prefixed by 0x and
+ * surrounded by blanks; blank lines are skipped. Nothing is written unless
+ * the whole file parses and fits.
+ *
+ * ELF files must be big-endian 32-bit ARM, executable or relocatable. The
+ * allocated sections of executables go to their addresses, which must lie in
+ * the memory map. Relocatable files are not relocated: their code sections
+ * are placed one after the other from the start of the text region, the
+ * others from the start of the data region. PC is set to the entry point, or
+ * to _start for relocatable files, and the symbols are kept for
+ * sim_symbol_at().
+ * \return 0 on success, -1 after printing an error, with the line number of
+ * the first malformed line for hex files; sim is left as it was. -2 after
+ * printing an error if sim got reinitialized, e.g. out of memory
+ */
+int loader_load(struct Simulator *sim, const char *fname);
+
+#endif
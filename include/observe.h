@@ -0,0 +1,32 @@
+#ifndef OBSERVE_H
+#define OBSERVE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sim.h"
+
+/** Kinds of memory access given to observe_memory() */
+#define MEM_ACCESS_WRITE 0x1 ///> else a read
+#define MEM_ACCESS_BYTE 0x2 ///> else a word
+
+/** True if one of the models watching execution is on: a trace, a profile,
+ * caches, the pipeline or a branch predictor. Runs of sim then go through
+ * observe_run().
+ */
+bool observe_enabled(const struct Simulator *sim);
+
+/** Process instructions like process_instructions(), one at a time, showing
+ * each to the models turned on.
+ * \return number of instructions executed
+ */
+uint64_t observe_run(struct Simulator *sim, uint64_t max_instr);
+
+/** Pass a memory access of the executing instruction to the models. Only
+ * called while sim->observing is set, so fetches by the decoder and accesses
+ * from the shell are left out.
+ * \param kind MEM_ACCESS_* flags
+ * \param value value read or written
+ */
+void observe_memory(const struct Simulator *sim, uint32_t address, uint8_t kind, uint32_t value);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "sim.h"
+#include "isa.h"
+#include "stats.h"
+
+struct Pipeline;
+
+/** Timing of the modeled pipeline, in cycles */
+struct PipelineConfig {
+    uint32_t branch_penalty; ///> fetched instructions flushed by a taken branch
+    uint32_t mul_latency; ///> cycles MUL and MLA spend in execute
+    uint32_t load_use_penalty; ///> stall of an instruction reading a register loaded just before
+};
+
+/** Fill config with the defaults: branches resolved in execute (2 cycles), 3
+ * cycle multiplies and 1 cycle load-use stalls
+ */
+void pipeline_default_config(struct PipelineConfig *config);
+
+/** Apply one option to config: branch=, mul= or loaduse=<cycles>.
+ * \return 0 on success, -1 after printing an error
+ */
+int pipeline_parse_option(struct PipelineConfig *config, const char *option);
+
+/** Start modeling the timing of a classic in-order 5-stage pipeline (fetch,
+ * decode, execute, memory, writeback) with full forwarding for sim, with
+ * zeroed counts. Runs of sim go through observe_run() until pipeline_stop().
+ * \return 0 on success, -1 after printing an error
+ */
+int pipeline_start(struct Simulator *sim, const struct PipelineConfig *config);
+
+/** Stop modeling the pipeline of sim */
+void pipeline_stop(struct Simulator *sim);
+
+/** Account for instr, about to execute on sim.
+ * \param predicted true if instr is a branch a predictor judged, see bpred.h
+ * \param mispredicted true if the predictor got it wrong
+ */
+void pipeline_issue(struct Simulator *sim, const struct DecodedInstr *instr, bool predicted,
+                    bool mispredicted);
+
+/** Zero the cycle counts */
+void pipeline_reset_counts(struct Pipeline *pipeline);
+
+/** Print the cycles, stalls and CPI of pipeline, as stats_print() does.
+ * \param memory_stalls cycles lost to cache misses, see cache.h
+ */
+void pipeline_print_stats(FILE *fp, const struct Pipeline *pipeline, uint64_t memory_stalls,
+                          enum StatsFormat format);
+
+#endif
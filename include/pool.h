@@ -0,0 +1,28 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/** A task of pool_run(), called once per index.
+ * \param arg argument given to pool_run()
+ * \param index index of the task, from 0 to nb_tasks - 1
+ * \param worker id of the calling worker, from 0 to nb_workers - 1, so that
+ *        tasks can keep per-worker resources such as a simulator
+ */
+typedef void (*PoolTask)(void *arg, size_t index, int worker);
+
+/** Run tasks 0 to nb_tasks - 1 on nb_workers threads and wait for all of them.
+ * Each worker starts with an equal share of the indexes, in order, and steals
+ * half of the remaining share of another worker once its own runs out, so
+ * uneven tasks still keep every worker busy.
+ * The caller is one of the workers. Should some threads fail to start, the
+ * others steal their share.
+ * \param nb_workers number of threads, 1 runs everything on the caller
+ * \return 0 on success, -1 if out of memory, no task was run then
+ */
+int pool_run(int nb_workers, size_t nb_tasks, PoolTask task, void *arg);
+
+/** Number of host cores available, at least 1 */
+int pool_nb_cores();
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "sim.h"
+#include "isa.h"
+
+struct Profile;
+
+/** Start counting the instructions sim retires at each PC, from zero.
+ * Runs of a profiled simulator go through observe_run(), so the other engines
+ * pay nothing while profiling is off.
+ * \return 0 on success, -1 after printing an error
+ */
+int profile_start(struct Simulator *sim);
+
+/** Stop counting, keeping the counts for profile_report() */
+void profile_stop(struct Simulator *sim);
+
+/** Release the counts of sim, if any */
+void profile_destroy(struct Simulator *sim);
+
+/** Count instr about to execute at pc */
+void profile_count(struct Profile *profile, uint32_t pc, const struct DecodedInstr *instr);
+
+/** Print the nb_top most executed instructions and basic blocks of sim, with
+ * their share of all instructions counted.
+ * \return 0 on success, -1 if sim was never profiled
+ */
+int profile_report(struct Simulator *sim, FILE *fp, uint32_t nb_top);
+
+#endif
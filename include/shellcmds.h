@@ -2,13 +2,49 @@
 #define SHELLCMDS_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "sim.h"
+#include "dump.h"
+#include "stats.h"
 
-void cmd_run();
+/** Execution engine used by cmd_run() */
+enum RunEngine {
+    RUN_INTERP, ///> one instruction at a time
+    RUN_BLOCKS, ///> one basic block at a time, see block.h
+    RUN_JIT, ///> hot blocks translated to native code, see jit.h
+};
+
+/** Write the rdump lines of state to fp */
+void dump_registers(FILE *fp, const struct CPUState *state);
+
+void cmd_run(enum RunEngine engine);
 void cmd_file(char *fname);
 void cmd_step(int nbstep);
-void cmd_mdump(uint32_t low_addr, uint32_t high_addr, char *fname);
+void cmd_mdump(uint32_t low_addr, uint32_t high_addr, char *fname, enum DumpMode mode);
 void cmd_rdump(char *fname);
 void cmd_set(int reg_num, uint32_t reg_val);
+void cmd_snapshot();
+void cmd_restore(int id);
+void cmd_checkpoint(char *fname, bool compress);
+void cmd_resume(char *fname);
+/** Start tracing to fname, or stop tracing if fname is NULL */
+void cmd_trace(char *fname);
+/** Start counting executions per PC from zero, or stop counting */
+void cmd_profile(bool on);
+/** Print the nb_top hottest PCs and basic blocks of the profile */
+void cmd_profile_report(uint32_t nb_top);
+/** Start modeling caches, configured by cache_parse_option() options, or stop */
+void cmd_cache(bool on, char **options, int nb_options);
+/** Start modeling the pipeline, configured by pipeline_parse_option() options, or stop */
+void cmd_pipeline(bool on, char **options, int nb_options);
+/** Start predicting branches, configured by bpred_parse_option() options, or stop */
+void cmd_bpred(bool on, char **options, int nb_options);
+/** Print the nb_top most mispredicted branches */
+void cmd_bpred_report(uint32_t nb_top);
+/** Print the execution statistics to fname, or stdout if NULL */
+void cmd_stats(char *fname, enum StatsFormat format);
+void cmd_stats_reset();
 void cmd_help();
 
 #endif
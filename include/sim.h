@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdbool.h>
 
 #define NB_REGS 16
 
@@ -18,14 +19,18 @@ struct CPUState {
     uint32_t regs[NB_REGS]; ///> Register File
     uint32_t CPSR; ///> Current Program Status Register
     uint8_t halted; ///> 1 if halted, 0 if running
+    uint8_t faulted; ///> 1 if halted by an access outside the memory map
+    uint32_t fault_address; ///> address of that access
 };
 
 // We are not implementing stack ops right now
 // The values below have been chosen arbitrarily
+// Regions are only backed by host memory where touched, the rest of the
+// 4 GiB address space faults
 #define MEM_TEXT_START 0x00000000
 #define MEM_TEXT_SIZE  0x00100000
 #define MEM_DATA_START 0x10000000
-#define MEM_DATA_SIZE  0x00100000
+#define MEM_DATA_SIZE  0x40000000
 
 #define NB_REGIONS 2
 #define MEM_TEXT 0
@@ -37,12 +42,25 @@ struct MemoryRegion {
     uint8_t *mem;
 };
 
+/* The functions below work on one default simulator, created on first use.
+ * The sim_* functions at the end do the same on a simulator of the caller's,
+ * any number of which can run at the same time, each on its own thread.
+ */
+
 /** Allocate memory, initialize CPU states */
 void initialize();
 /** Set all registers to 0 */
 void reset_cpu();
-/** Load program into memory */
-void load_program(FILE *code);
+/** Reinitialize, then load program fname into memory, either a hex file or a
+ * big-endian ARM ELF file, see loader_load().
+ * \return 0 on success, -1 after printing an error, leaving the program
+ *         loaded before alone, -2 after printing an error once reinitialized
+ */
+int load_program(const char *fname);
+/** True if address lies in one of the memory regions.
+ * Other addresses must not be passed to mem_* outside of cpu_* runs.
+ */
+bool mem_mapped(uint32_t address);
 /** Write 32-bit data to address (Big-Endian) */
 void mem_write_32(uint32_t address, uint32_t data);
 /** Read 32-bit data from address (Big-Endian) */
@@ -52,12 +70,98 @@ void mem_write_8(uint32_t address, uint8_t data);
 /** Read 8-bit data from address (don't care endianness) */
 uint8_t mem_read_8(uint32_t address);
 /** Execute CPU cycle.
+ * An access outside the memory map halts the CPU with faulted set.
  * \return 0 for success, -1 for halted
  */
 int cpu_cycle();
+/** Execute CPU cycles until max_cycles were executed or the CPU halts.
+ * An access outside the memory map halts the CPU with faulted set.
+ * \return number of instructions executed, including the halting one,
+ * 0 after a fault
+ */
+uint64_t cpu_run(uint64_t max_cycles);
+/** Same as cpu_run(), but executes a basic block at a time (see block.h) */
+uint64_t cpu_run_blocks(uint64_t max_cycles);
+/** Same as cpu_run(), but translates hot code to native code (see jit.h) */
+uint64_t cpu_run_jit(uint64_t max_cycles);
+/** Saved CPU state and memory contents, see snapshot_take() */
+struct Snapshot;
+
+/** Save CPU state and memory. Only pages written since initialize() are
+ * copied, restoring is copy-on-write.
+ * \return the snapshot, NULL on failure
+ */
+struct Snapshot * snapshot_take();
+/** Bring CPU state and memory back to snap. A snapshot can be restored any
+ * number of times, each restore starts an independent copy of it. Decoded
+ * and translated code is kept if the text region is the same.
+ * \return 0 on success, -1 on failure (the simulator is then reinitialized)
+ */
+int snapshot_restore(const struct Snapshot *snap);
+/** Release snap */
+void snapshot_free(struct Snapshot *snap);
 /** Return current cpu state */
 struct CPUState get_cpu_state();
 /** Set register to data */
 void set_reg(uint8_t reg_num, uint16_t data);
 
+/** CPU state, memory and code caches of one simulation, see simulator.h */
+struct Simulator;
+
+/** Create a simulator, with its own reservation of the guest address space.
+ * Memory is not mapped until sim_initialize().
+ * \return NULL on failure
+ */
+struct Simulator * sim_create();
+/** Release sim and all its memory */
+void sim_destroy(struct Simulator *sim);
+/** Simulator used by the functions above */
+struct Simulator * sim_default();
+/** Same as initialize(), on sim.
+ * \return 0 on success, -1 if guest memory could not be mapped
+ */
+int sim_initialize(struct Simulator *sim);
+/** Same as reset_cpu(), on sim */
+void sim_reset_cpu(struct Simulator *sim);
+/** Same as load_program(), on sim */
+int sim_load_program(struct Simulator *sim, const char *fname);
+/** Same as mem_mapped(), on sim */
+bool sim_mem_mapped(const struct Simulator *sim, uint32_t address);
+/** Same as mem_write_32(), on sim */
+void sim_mem_write_32(struct Simulator *sim, uint32_t address, uint32_t data);
+/** Same as mem_read_32(), on sim */
+uint32_t sim_mem_read_32(const struct Simulator *sim, uint32_t address);
+/** Same as mem_write_8(), on sim */
+void sim_mem_write_8(struct Simulator *sim, uint32_t address, uint8_t data);
+/** Copy size bytes of data to address of sim, all in one region.
+ * \return 0 on success, -1 if the range is not inside a single region
+ */
+int sim_mem_write_bytes(struct Simulator *sim, uint32_t address, const void *data,
+                        uint32_t size);
+/** Same as mem_read_8(), on sim */
+uint8_t sim_mem_read_8(const struct Simulator *sim, uint32_t address);
+/** Same as cpu_cycle(), on sim */
+int sim_cpu_cycle(struct Simulator *sim);
+/** Same as cpu_run(), on sim */
+uint64_t sim_cpu_run(struct Simulator *sim, uint64_t max_cycles);
+/** Same as cpu_run_blocks(), on sim */
+uint64_t sim_cpu_run_blocks(struct Simulator *sim, uint64_t max_cycles);
+/** Same as cpu_run_jit(), on sim */
+uint64_t sim_cpu_run_jit(struct Simulator *sim, uint64_t max_cycles);
+/** Same as snapshot_take(), on sim */
+struct Snapshot * sim_snapshot_take(const struct Simulator *sim);
+/** Same as snapshot_restore(), on sim. The snapshot may come from another
+ * simulator.
+ */
+int sim_snapshot_restore(struct Simulator *sim, const struct Snapshot *snap);
+/** Find the symbol of the loaded ELF program containing address.
+ * \param offset set to the offset of address from the symbol
+ * \return symbol name, NULL if there is none
+ */
+const char * sim_symbol_at(const struct Simulator *sim, uint32_t address, uint32_t *offset);
+/** Same as get_cpu_state(), on sim */
+struct CPUState sim_get_cpu_state(const struct Simulator *sim);
+/** Set register of sim to data */
+void sim_set_reg(struct Simulator *sim, uint8_t reg_num, uint32_t data);
+
 #endif
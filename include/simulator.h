@@ -0,0 +1,88 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <stdint.h>
+#include "sim.h"
+#include "isa.h"
+#include "isa_helper.h"
+#include "stats.h"
+
+struct BlockCache;
+struct JitCache;
+struct Trace;
+struct Profile;
+struct CacheModel;
+struct Pipeline;
+struct BranchPredictor;
+
+/** A symbol of the loaded program */
+struct Symbol {
+    uint32_t address;
+    uint32_t size; ///> 0 if unknown
+    const char *name; ///> points into Simulator.symbol_names
+};
+
+#define MEM_SPACE_SIZE (UINT64_C(1) << 32)
+#define MEM_PAGE_BITS 12
+#define MEM_PAGE_SIZE (1 << MEM_PAGE_BITS)
+
+/** Everything one simulation needs, so that any number of them can run in one
+ * process, each on its own thread. Only the simulator modules look inside,
+ * users go through the sim_* functions of sim.h.
+ */
+struct Simulator {
+    struct CPUState cpu; ///> first, so translated code reaches registers with 8-bit offsets
+
+    // isa.c
+    struct WriteBack wb; ///> pending writes of the executing instruction
+    struct LazyFlags lazy; ///> last flag-setting op not yet in cpu.CPSR
+    struct DecodedInstr uncached; ///> decode of an instruction outside the text region
+    struct SimStats stats; ///> see stats.c, reset by sim_initialize()
+    // one slot per word of the text region, indexed by (PC - MEM_TEXT_START) / 4
+    struct DecodedInstr decode_cache[MEM_TEXT_SIZE / 4];
+    uint32_t decode_used; ///> slots from here on are all empty, keeps flushes short
+
+    // block.c and jit.c
+    struct BlockCache *blocks;
+    struct JitCache *jit;
+
+    // trace.c
+    struct Trace *trace; ///> NULL unless tracing
+
+    // profile.c
+    struct Profile *profile; ///> counts of the last profile, NULL if none
+    uint8_t profiling; ///> 1 if runs count into profile
+
+    // cache.c
+    struct CacheModel *caches; ///> NULL unless modeling caches
+
+    // pipeline.c
+    struct Pipeline *pipeline; ///> NULL unless modeling the pipeline
+
+    // bpred.c
+    struct BranchPredictor *bpred; ///> NULL unless predicting branches
+
+    // observe.c
+    uint8_t observing; ///> 1 while observe_run() executes an instruction
+
+    // sim.c
+    struct MemoryRegion mem_region[NB_REGIONS];
+    uint8_t *mem_base; ///> host address of guest address 0
+    /** Bit n is set if guest page n was written since initialization, i.e.
+     * might hold something else than zeros. Snapshots only copy these pages.
+     */
+    uint8_t written[(MEM_SPACE_SIZE >> MEM_PAGE_BITS) / 8];
+    /** Identifies the contents of the text region, changes on every write to
+     * it. Restoring a snapshot with the same version keeps all decoded code.
+     */
+    uint64_t text_version;
+    // symbols of an ELF program, by increasing address, see loader.c
+    struct Symbol *symbols;
+    uint32_t nb_symbols;
+    char *symbol_names;
+};
+
+/** Forget the symbols of the previous program */
+void sim_clear_symbols(struct Simulator *sim);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "sim.h"
+#include "isa.h"
+
+/** Execution statistics of a simulator, kept by every engine since the
+ * program was loaded or the statistics reset.
+ * B and BL are the INSTR_BL class: executed ones are taken branches, those
+ * failing their condition are not taken.
+ */
+struct SimStats {
+    uint64_t executed[NB_INSTR_OPS]; ///> retired with their condition passed, by enum InstrOp
+    uint64_t cond_failed[NB_INSTR_OPS]; ///> retired with their condition failed, by enum InstrOp
+    uint64_t nb_runs; ///> runs and steps
+    uint64_t run_instr; ///> instructions retired by runs, as they returned
+    uint64_t run_ns; ///> host time spent in runs
+};
+
+/** Output format of stats_print() */
+enum StatsFormat {
+    STATS_TEXT, ///> aligned table for people
+    STATS_CSV, ///> "name,value" lines, names stay the same across releases
+};
+
+/** Zero the statistics of sim */
+void stats_reset(struct Simulator *sim);
+
+/** Print the statistics of sim to fp, along with the simulated MIPS and
+ * those of the models turned on
+ */
+void stats_print(FILE *fp, const struct Simulator *sim, enum StatsFormat format);
+
+/** Print one statistic of stats_print() */
+void stats_print_count(FILE *fp, enum StatsFormat format, const char *name, uint64_t value);
+void stats_print_real(FILE *fp, enum StatsFormat format, const char *name, double value);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "sim.h"
+#include "observe.h"
+
+struct Trace;
+
+/** Start tracing every instruction sim retires to fname, until trace_stop().
+ * Records go into a ring buffer which a writer thread compresses to disk, the
+ * simulation only waits if the ring is full. Runs of a traced simulator go
+ * through observe_run().
+ * \return 0 on success, -1 after printing an error
+ */
+int trace_start(struct Simulator *sim, const char *fname);
+
+/** Stop tracing sim, waiting for the whole trace to be on disk.
+ * \param nb_instr set to the number of instructions traced
+ * \return 0 on success, -1 if the trace could not be written completely
+ */
+int trace_stop(struct Simulator *sim, uint64_t *nb_instr);
+
+/** Bring the trace up to date with the registers of sim before a run, they
+ * may have been changed from outside since the last instruction traced.
+ * Flags must be in sync, see isa_sync_flags().
+ */
+void trace_sync(struct Simulator *sim);
+
+/** Record the instruction which just executed @ pc, with the memory accesses
+ * given to trace_memory() meanwhile. Flags must be in sync.
+ */
+void trace_instruction(struct Simulator *sim, uint32_t pc, uint32_t instruction);
+
+/** Record a memory access of the instruction being traced.
+ * \param kind MEM_ACCESS_* flags
+ * \param value value read or written
+ */
+void trace_memory(struct Trace *trace, uint32_t address, uint8_t kind, uint32_t value);
+
+/** Print the trace in fname as text to out, one line per instruction.
+ * \return 0 on success, -1 after printing an error
+ */
+int trace_decode(const char *fname, FILE *out);
+
+#endif
@@ -1,6 +1,8 @@
+#include <string.h>
 #include "isa_helper.h"
 #include "isa.h"
 #include "sim.h"
+#include "simulator.h"
 
 enum DataProcOpcode {
     OP_AND, OP_EOR, OP_SUB, OP_RSB,
@@ -9,394 +11,630 @@ enum DataProcOpcode {
     OP_ORR, OP_MOV, OP_BIC, OP_MVN,
 };
 
-static void decode_and_exec(uint32_t instruction);
-static void exec_ADC(uint32_t instruction);
-static void exec_ADD(uint32_t instruction);
-static void exec_AND(uint32_t instruction);
-static void exec_BIC(uint32_t instruction);
-static void exec_LDR(uint32_t instruction);
-static void exec_STR(uint32_t instruction);
-static void exec_LDRB(uint32_t instruction);
-static void exec_STRB(uint32_t instruction);
-static void exec_SWI(uint32_t instruction);
-static void exec_RSC(uint32_t instruction);
-static void exec_CMP(uint32_t instruction);
-static void exec_CMN(uint32_t instruction);
-static void exec_EOR(uint32_t instruction);
-static void exec_ORR(uint32_t instruction);
-static void exec_TST(uint32_t instruction);
-static void exec_BL(uint32_t instruction);
-static void exec_RSB(uint32_t instruction);
-static void exec_SUB(uint32_t instruction);
-static void exec_TEQ(uint32_t instruction);
-static void exec_SBC(uint32_t instruction);
-static void exec_MUL(uint32_t instruction);
-static void exec_MLA(uint32_t instruction);
-static void exec_MOV(uint32_t instruction);
-static void exec_MVN(uint32_t instruction);
-
-static struct CPUState next_state, curr_state;
-
-struct CPUState process_instruction(struct CPUState state)
-{
-    if (state.halted) {
-        return state;
+static void decode(struct DecodedInstr *instr, uint32_t instruction);
+static const struct DecodedInstr * fetch_decoded(struct Simulator *sim, uint32_t address);
+static bool reads_carry(const struct DecodedInstr *instr);
+#define X(name) static void exec_##name(struct Simulator *sim, const struct DecodedInstr *instr);
+    OTHER_OPS
+#undef X
+
+/* Kinds of data-processing shifter operand: the immediate, then register
+ * operands in the order of their encoding in bits 6-4.
+ */
+#define SHIFTER_KINDS(op, S) \
+    V(op, IMM, S) V(op, LSL_IMM, S) V(op, LSL_REG, S) V(op, LSR_IMM, S) \
+    V(op, LSR_REG, S) V(op, ASR_IMM, S) V(op, ASR_REG, S) V(op, ROR_IMM, S) \
+    V(op, ROR_REG, S)
+
+/* Every handler variant of data-processing op: one per shifter kind, with the
+ * S bit clear and set.
+ */
+#define DP_VARIANTS(op) SHIFTER_KINDS(op, 0) SHIFTER_KINDS(op, 1)
+
+enum ShifterKind {
+#define V(op, kind, S) SHIFTER_##kind,
+    SHIFTER_KINDS(_, 0)
+#undef V
+    NB_SHIFTER_KINDS
+};
+
+/** Index of a handler in handlers[], data-processing variants come first in
+ * (opcode, S, shifter kind) order, then the other ops in InstrOp order.
+ */
+enum HandlerId {
+#define V(op, kind, S) HANDLER_##op##_##kind##_S##S,
+#define X(op) DP_VARIANTS(op)
+    DP_OPS
+#undef X
+#undef V
+#define X(name) HANDLER_##name,
+    OTHER_OPS
+#undef X
+};
+
+#define V(op, kind, S) \
+    static void exec_##op##_##kind##_S##S(struct Simulator *sim, const struct DecodedInstr *instr);
+#define X(op) DP_VARIANTS(op)
+    DP_OPS
+#undef X
+#undef V
+
+static const InstrHandler handlers[] = {
+#define V(op, kind, S) exec_##op##_##kind##_S##S,
+#define X(op) DP_VARIANTS(op)
+    DP_OPS
+#undef X
+#undef V
+#define X(name) exec_##name,
+    OTHER_OPS
+#undef X
+};
+
+/** Bring N, Z, C and V in sim->cpu.CPSR up to date */
+static inline void sync_flags(struct Simulator *sim)
+{
+    if (sim->lazy.kind != FLAGS_NONE) {
+        sim->cpu.CPSR = materialize_flags(sim->cpu.CPSR, &sim->lazy);
+        sim->lazy.kind = FLAGS_NONE;
     }
-    next_state = curr_state = state;
-    uint32_t instruction = mem_read_32(curr_state.regs[PC]);
-    decode_and_exec(instruction);
-    next_state.regs[PC] += 4;
-    return next_state;
 }
 
-static void decode_and_exec(uint32_t instruction)
+/** Record flags of op1 + op2 + carry_in, subtractions pass ~op2 */
+static inline void set_flags_add(struct Simulator *sim, uint32_t op1, uint32_t op2, uint8_t carry_in,
+                                 uint32_t result)
 {
-    if (!condition_check(curr_state, get_bits(instruction, 31, 28))) {
-        return;
-    }
-    if (get_bits(instruction, 27, 25) == 0x2 ||
-        (get_bits(instruction, 27, 25) ==  0x3 && get_bit(instruction, 4) == 0)) {
-        // LOAD STORE INSTRUCTIONS
-        if (get_bit(instruction, B_BIT) == 0) {
-            if (get_bit(instruction, L_BIT) == 1) { // LDR
-                exec_LDR(instruction);
-            } else { // STR
-                exec_STR(instruction);
-            }
-        } else {
-            if (get_bit(instruction, L_BIT) == 1) { // LDRB
-                exec_LDRB(instruction);
-                // no ure mum does dis evry night
-            } else { // STRB
-                exec_STRB(instruction);
-            }
-        }
-    } else if ((get_bits(instruction, 27, 25) == 0x0 &&
-                    (!get_bit(instruction, 4) ||
-                         (!get_bit(instruction, 7) && get_bit(instruction, 4)))) ||
-               (get_bits(instruction, 27, 25) == 0x1)) {
-        // DATA PROCESSING INSTRUCTIONS
-        enum DataProcOpcode opcode = get_bits(instruction, 24, 21);
-        switch (opcode) {
-            case OP_AND: exec_AND(instruction); break;
-            case OP_EOR: exec_EOR(instruction); break;
-            case OP_SUB: exec_SUB(instruction); break;
-            case OP_RSB: exec_RSB(instruction); break;
-            case OP_ADD: exec_ADD(instruction); break;
-            case OP_ADC: exec_ADC(instruction); break;
-            case OP_SBC: exec_SBC(instruction); break;
-            case OP_RSC: exec_RSC(instruction); break;
-            case OP_TST: exec_TST(instruction); break;
-            case OP_TEQ: exec_TEQ(instruction); break;
-            case OP_CMP: exec_CMP(instruction); break;
-            case OP_CMN: exec_CMN(instruction); break;
-            case OP_ORR: exec_ORR(instruction); break;
-            case OP_MOV: exec_MOV(instruction); break;
-            case OP_BIC: exec_BIC(instruction); break;
-            case OP_MVN: exec_MVN(instruction); break;
-        }
-    } else if (get_bits(instruction, 27, 24) == 0xf) { // SWI
-        exec_SWI(instruction);
-    } else if (get_bits(instruction, 27, 24) == 0x0 && get_bits(instruction, 7, 4) == 0x9) {
-        // MULTIPLY INSTRUCTIONS
-        if (get_bits(instruction, 23, 21) == 0x1) { // MLA
-            exec_MLA(instruction);
-        } else if (get_bits(instruction, 23, 21) == 0x0) { // MUL
-            exec_MUL(instruction);
-        }
-    } else if (get_bits(instruction, 27, 25) == 0x5) {
-        // BRANCH (optionally with LINK)
-        exec_BL(instruction);
-    }
+    sim->wb.flags.kind = FLAGS_ADD;
+    sim->wb.flags.op1 = op1;
+    sim->wb.flags.op2 = op2;
+    sim->wb.flags.carry = carry_in;
+    sim->wb.flags.result = result;
 }
 
-static void exec_LDR(uint32_t instruction)
+/** Record flags of a logical op, V is kept */
+static inline void set_flags_logic(struct Simulator *sim, uint32_t result, uint8_t shifter_carry)
 {
-    uint32_t address = ld_str_addr_mode(curr_state, &next_state, instruction);
-    uint32_t data = mem_read_32(address);
-    uint32_t rd_id = get_bits(instruction, 15, 12);
-    next_state.regs[rd_id] = data;
+    sync_flags(sim); // V may still be pending from an earlier op
+    sim->wb.flags.kind = FLAGS_LOGIC;
+    sim->wb.flags.carry = shifter_carry;
+    sim->wb.flags.result = result;
 }
 
-static void exec_STR(uint32_t instruction)
+/** Record flags of a multiply, C and V are kept */
+static inline void set_flags_mul(struct Simulator *sim, uint32_t result)
 {
-    uint32_t rd_id = get_bits(instruction, 15, 12);
-    uint32_t data = curr_state.regs[rd_id];
-    uint32_t address = ld_str_addr_mode(curr_state, &next_state, instruction);
-    mem_write_32(address, data);
+    sync_flags(sim);
+    sim->wb.flags.kind = FLAGS_MUL;
+    sim->wb.flags.result = result;
 }
 
-static void exec_STRB(uint32_t instruction)
+/** Start executing an instruction, with no writes pending */
+static inline void begin_instr(struct Simulator *sim)
 {
-    uint32_t rd_id = get_bits(instruction, 15, 12);
-    uint8_t data = curr_state.regs[rd_id] & 0xff; // LSB byte of reg
-    uint32_t address = ld_str_addr_mode(curr_state, &next_state, instruction);
-    mem_write_8(address, data);
+    sim->wb.nb_regs = 0;
+    sim->wb.flags.kind = FLAGS_NONE;
+    sim->wb.halted = 0;
 }
 
-static void exec_CMN(uint32_t instruction)
+/** Commit pending writes of the executing instruction and increment PC by 4 */
+static inline void retire_instr(struct Simulator *sim)
 {
-    uint32_t Rn_addr = get_bits(instruction, 19, 16);
-    struct ShifterOperand *shifter_op = shifter_operand(curr_state, instruction);
-    uint32_t op1 = curr_state.regs[Rn_addr];
-    uint32_t op2 = shifter_op->shifter_operand;
+    for (uint8_t i = 0; i < sim->wb.nb_regs; i++) {
+        sim->cpu.regs[sim->wb.reg_ids[i]] = sim->wb.reg_vals[i];
+    }
+    if (sim->wb.flags.kind != FLAGS_NONE) {
+        sim->lazy = sim->wb.flags;
+    }
+    sim->cpu.halted = sim->wb.halted;
+    sim->cpu.regs[PC] += 4;
+}
 
-    uint32_t alu_out = op1 + op2;
+/** Check <cond> of instr, flags are only materialized if it needs them */
+static inline bool should_execute(struct Simulator *sim, const struct DecodedInstr *instr)
+{
+    if (!instr->needs_flags) { // AL and does not read the carry
+        return true;
+    }
+    sync_flags(sim);
+    return condition_check(&sim->cpu, instr->cond);
+}
+
+/** Execute instr on cpu, flags might be left lazy */
+static inline void execute(struct Simulator *sim, const struct DecodedInstr *instr)
+{
+    begin_instr(sim);
+    if (should_execute(sim, instr)) {
+        sim->stats.executed[instr->op]++;
+        instr->handler(sim, instr);
+    } else {
+        sim->stats.cond_failed[instr->op]++;
+    }
+    retire_instr(sim);
+}
 
-    set_bit(&(next_state.CPSR), CPSR_N, get_bit(alu_out, 31));
-    set_bit(&(next_state.CPSR), CPSR_Z, alu_out ? 0 : 1);
-    set_bit(&(next_state.CPSR), CPSR_C, check_add_carry(op1, op2));
-    set_bit(&(next_state.CPSR), CPSR_V, check_overflow(op1, op2));
+/** Execute instruction @ PC of cpu, flags might be left lazy */
+static inline void step(struct Simulator *sim)
+{
+    execute(sim, fetch_decoded(sim, sim->cpu.regs[PC]));
 }
 
-static void exec_CMP(uint32_t instruction)
+void process_instruction(struct Simulator *sim)
 {
-    uint32_t Rn_addr = get_bits(instruction, 19, 16);
-    struct ShifterOperand *shifter_op = shifter_operand(curr_state, instruction);
-    uint32_t op1 = curr_state.regs[Rn_addr];
-    uint32_t op2 = shifter_op->shifter_operand;
+    if (sim->cpu.halted) {
+        return;
+    }
+    step(sim);
+    sync_flags(sim);
+}
 
-    uint32_t alu_out = op1 - op2;
+#ifndef THREADED_DISPATCH
 
-    set_bit(&(next_state.CPSR), CPSR_N, get_bit(alu_out, 31));
-    set_bit(&(next_state.CPSR), CPSR_Z, alu_out ? 0 : 1);
-    set_bit(&(next_state.CPSR), CPSR_C, !check_sub_borrow(op1, op2));
-    set_bit(&(next_state.CPSR), CPSR_V, check_overflow(op1, -op2));
+uint64_t process_instructions(struct Simulator *sim, uint64_t max_instr)
+{
+    uint64_t nb_instr = 0;
+    while (nb_instr < max_instr && !sim->cpu.halted) {
+        step(sim);
+        nb_instr++;
+    }
+    sync_flags(sim);
+    return nb_instr;
 }
 
-static void exec_EOR(uint32_t instruction)
+#else
+
+/* Direct-threaded interpreter: every handler label ends with its own copy of
+ * DISPATCH(), so the host predicts each indirect jump from the previous guest
+ * instruction instead of from one shared switch.
+ */
+uint64_t process_instructions(struct Simulator *sim, uint64_t max_instr)
 {
-    uint32_t Rn_addr = get_bits(instruction, 19, 16);
-    uint32_t Rd_addr = get_bits(instruction, 15, 12);
-    struct ShifterOperand *shifter_op = shifter_operand(curr_state, instruction);
+    static void * const labels[] = {
+#define V(op, kind, S) &&do_##op##_##kind##_S##S,
+#define X(op) DP_VARIANTS(op)
+        DP_OPS
+#undef X
+#undef V
+#define X(name) &&do_##name,
+        OTHER_OPS
+#undef X
+    };
+    const struct DecodedInstr *instr;
+    uint64_t n = 0;
+
+#define DISPATCH() \
+    do { \
+        if (n == max_instr || sim->cpu.halted) { \
+            goto done; \
+        } \
+        n++; \
+        instr = fetch_decoded(sim, sim->cpu.regs[PC]); \
+        begin_instr(sim); \
+        if (!should_execute(sim, instr)) { \
+            goto skip; \
+        } \
+        sim->stats.executed[instr->op]++; \
+        goto *labels[instr->handler_id]; \
+    } while (0)
+
+    DISPATCH();
+#define V(op, kind, S) \
+    do_##op##_##kind##_S##S: \
+        exec_##op##_##kind##_S##S(sim, instr); \
+        retire_instr(sim); \
+        DISPATCH();
+#define X(op) DP_VARIANTS(op)
+    DP_OPS
+#undef X
+#undef V
+#define X(name) \
+    do_##name: \
+        exec_##name(sim, instr); \
+        retire_instr(sim); \
+        DISPATCH();
+    OTHER_OPS
+#undef X
+skip:
+    sim->stats.cond_failed[instr->op]++;
+    retire_instr(sim);
+    DISPATCH();
+#undef DISPATCH
+done:
+    sync_flags(sim);
+    return n;
+}
 
-    next_state.regs[Rd_addr] = curr_state.regs[Rn_addr] ^ shifter_op->shifter_operand;
+#endif
 
-    if(get_bit(instruction, S_BIT) == 1){
-        set_bit(&(next_state.CPSR), CPSR_N, get_bit(curr_state.regs[Rd_addr], 31));
-        set_bit(&(next_state.CPSR), CPSR_Z, next_state.regs[Rd_addr] ? 0 : 1);
-        set_bit(&(next_state.CPSR), CPSR_C, shifter_op->shifter_carry);
-    }
+void isa_execute_decoded(struct Simulator *sim, const struct DecodedInstr *instr)
+{
+    execute(sim, instr);
 }
 
-// reverse subtract, with carry
-static void exec_RSC(uint32_t instruction)
-{
-    struct ShifterOperand * shiftop;
-    shiftop = shifter_operand(curr_state, instruction);
-    uint8_t rd_id = get_bits(instruction, 15, 12);
-    uint8_t rn_id = get_bits(instruction, 19, 16);
-    uint32_t rn_val = curr_state.regs[rn_id];
-    bool carry = get_bit(curr_state.CPSR, CPSR_C);
-    uint32_t rd_val = shiftop->shifter_operand - rn_val - !carry;
-    next_state.regs[rd_id] = rd_val;
-    if (get_bit(instruction, S_BIT) == 1) {
-        set_bit(&next_state.CPSR, CPSR_N, get_bit(rd_val, 31));
-        set_bit(&next_state.CPSR, CPSR_Z, (rd_val ? 0 : 1));
-        set_bit(&next_state.CPSR, CPSR_C,
-                !check_sub_borrow(shiftop->shifter_operand, rn_val + !carry)); // c = !b
-        set_bit(&next_state.CPSR, CPSR_V,
-                check_overflow(shiftop->shifter_operand, -rn_val));
+uint32_t isa_execute_block(struct Simulator *sim, uint32_t address, uint32_t nb_instr)
+{
+    const struct DecodedInstr *instr = &sim->decode_cache[(address - MEM_TEXT_START) >> 2];
+    for (uint32_t i = 0; i < nb_instr; i++, instr++) {
+        if (instr->handler == NULL) { // overwritten by an earlier store
+            return i;
+        }
+        execute(sim, instr);
     }
+    return nb_instr;
 }
 
-static void exec_ORR(uint32_t instruction)
+void isa_sync_flags(struct Simulator *sim)
 {
-    uint32_t Rn_addr = get_bits(instruction, 19, 16);
-    uint32_t Rd_addr = get_bits(instruction, 15, 12);
-    struct ShifterOperand *shifter_op = shifter_operand(curr_state, instruction);
+    sync_flags(sim);
+}
 
-    next_state.regs[Rd_addr] = curr_state.regs[Rn_addr] | shifter_op->shifter_operand;
+const struct DecodedInstr * isa_decoded_at(struct Simulator *sim, uint32_t address)
+{
+    return fetch_decoded(sim, address);
+}
 
-    if(get_bit(instruction, S_BIT) == 1){
-        set_bit(&(next_state.CPSR), CPSR_N, get_bit(curr_state.regs[Rd_addr], 31));
-        set_bit(&(next_state.CPSR), CPSR_Z, next_state.regs[Rd_addr] ? 0 : 1);
-        set_bit(&(next_state.CPSR), CPSR_C, shifter_op->shifter_carry);
+void isa_invalidate(struct Simulator *sim, uint32_t address)
+{
+    uint32_t offset = address - MEM_TEXT_START;
+    if (offset < MEM_TEXT_SIZE) {
+        sim->decode_cache[offset >> 2].handler = NULL;
     }
 }
 
-static void exec_TST(uint32_t instruction)
+void isa_flush_decode_cache(struct Simulator *sim)
 {
-    uint32_t Rn_addr = get_bits(instruction, 19, 16);
-    struct ShifterOperand *shifter_op = shifter_operand(curr_state, instruction);
+    memset(sim->decode_cache, 0, sim->decode_used * sizeof(struct DecodedInstr));
+    sim->decode_used = 0;
+}
 
-    uint32_t alu_out = curr_state.regs[Rn_addr] & shifter_op->shifter_operand;
+/** Return decoded instruction @ address, decoding it on first use.
+ * Words outside the text region (or unaligned) are decoded every time.
+ */
+static const struct DecodedInstr * fetch_decoded(struct Simulator *sim, uint32_t address)
+{
+    uint32_t offset = address - MEM_TEXT_START;
+    if (offset >= MEM_TEXT_SIZE || (offset & 0x3)) {
+        decode(&sim->uncached, sim_mem_read_32(sim, address));
+        return &sim->uncached;
+    }
+    struct DecodedInstr *slot = &sim->decode_cache[offset >> 2];
+    if (slot->handler == NULL) {
+        decode(slot, sim_mem_read_32(sim, address));
+        if ((offset >> 2) >= sim->decode_used) {
+            sim->decode_used = (offset >> 2) + 1;
+        }
+    }
+    return slot;
+}
 
-    set_bit(&(next_state.CPSR), CPSR_N, get_bit(alu_out, 31));
-    set_bit(&(next_state.CPSR), CPSR_Z, alu_out ? 0 : 1);
-    set_bit(&(next_state.CPSR), CPSR_C, shifter_op->shifter_carry);
+static void decode(struct DecodedInstr *instr, uint32_t instruction)
+{
+    memset(instr, 0, sizeof(struct DecodedInstr));
+    instr->instruction = instruction;
+    instr->cond = get_bits(instruction, 31, 28);
+    instr->op = INSTR_UND;
+    if (get_bits(instruction, 27, 25) == 0x2 ||
+        (get_bits(instruction, 27, 25) ==  0x3 && get_bit(instruction, 4) == 0)) {
+        // LOAD STORE INSTRUCTIONS
+        instr->rd = get_bits(instruction, 15, 12);
+        instr->rn = get_bits(instruction, 19, 16);
+        instr->rm = get_bits(instruction, 3, 0);
+        instr->I = get_bit(instruction, I_BIT);
+        instr->P = get_bit(instruction, P_BIT);
+        instr->U = get_bit(instruction, U_BIT);
+        instr->W = get_bit(instruction, W_BIT);
+        instr->L = get_bit(instruction, L_BIT);
+        instr->imm = get_bits(instruction, 11, 0);
+        if (get_bit(instruction, B_BIT) == 0) {
+            instr->op = instr->L ? INSTR_LDR : INSTR_STR;
+        } else {
+            instr->op = instr->L ? INSTR_LDRB : INSTR_STRB;
+        }
+    } else if ((get_bits(instruction, 27, 25) == 0x0 &&
+                    (!get_bit(instruction, 4) ||
+                         (!get_bit(instruction, 7) && get_bit(instruction, 4)))) ||
+               (get_bits(instruction, 27, 25) == 0x1)) {
+        // DATA PROCESSING INSTRUCTIONS
+        instr->rd = get_bits(instruction, 15, 12);
+        instr->rn = get_bits(instruction, 19, 16);
+        instr->rm = get_bits(instruction, 3, 0);
+        instr->rs = get_bits(instruction, 11, 8);
+        instr->S = get_bit(instruction, S_BIT);
+        instr->I = get_bit(instruction, I_BIT);
+        enum ShifterKind kind;
+        if (instr->I) {
+            uint8_t rotate_imm = get_bits(instruction, 11, 8) << 1;
+            instr->imm = rotate_right(get_bits(instruction, 7, 0), rotate_imm);
+            instr->imm_rotated = rotate_imm != 0;
+            kind = SHIFTER_IMM;
+        } else {
+            instr->shift_imm = get_bits(instruction, 11, 7);
+            kind = SHIFTER_LSL_IMM + get_bits(instruction, 6, 4);
+        }
+        enum DataProcOpcode opcode = get_bits(instruction, 24, 21);
+        instr->op = INSTR_AND + opcode;
+        instr->handler_id = (opcode * 2 + instr->S) * NB_SHIFTER_KINDS + kind;
+    } else if (get_bits(instruction, 27, 24) == 0xf) { // SWI
+        instr->imm = get_bits(instruction, 23, 0);
+        instr->op = INSTR_SWI;
+    } else if (get_bits(instruction, 27, 24) == 0x0 && get_bits(instruction, 7, 4) == 0x9) {
+        // MULTIPLY INSTRUCTIONS, Rd and Rn are swapped w.r.t. data processing
+        instr->rd = get_bits(instruction, 19, 16);
+        instr->rn = get_bits(instruction, 15, 12);
+        instr->rs = get_bits(instruction, 11, 8);
+        instr->rm = get_bits(instruction, 3, 0);
+        instr->S = get_bit(instruction, S_BIT);
+        if (get_bits(instruction, 23, 21) == 0x1) { // MLA
+            instr->op = INSTR_MLA;
+        } else if (get_bits(instruction, 23, 21) == 0x0) { // MUL
+            instr->op = INSTR_MUL;
+        }
+    } else if (get_bits(instruction, 27, 25) == 0x5) {
+        // BRANCH (optionally with LINK)
+        // value in PC acc. to arm_arm pg A4-10 is <curr_instruction_address + 8>
+        // we store current_instruction_address in PC instead
+        // also we unconditionally update PC to PC + 4 in process_instruction
+        // thus for us offset = given_offset + 8 - 4 = given_offset + 4
+        instr->L = get_bit(instruction, 24);
+        instr->imm = (sign_extend(get_bits(instruction, 23, 0), 24, 30) << 2) + 4;
+        instr->op = INSTR_BL;
+    }
+    if (condition_never(instr->cond)) { // never executes, i.e. an unconditional no-op
+        instr->op = INSTR_UND;
+        instr->cond = COND_AL;
+    }
+    if (instr->op >= INSTR_LDR) { // other ops keep their InstrOp order
+        instr->handler_id = HANDLER_LDR + (instr->op - INSTR_LDR);
+    }
+    instr->needs_flags = !condition_always(instr->cond) || reads_carry(instr);
+    instr->handler = handlers[instr->handler_id];
+}
 
+/** True if executing instr reads the C flag of CPSR */
+static bool reads_carry(const struct DecodedInstr *instr)
+{
+    // shift_imm = 0 with ROR encodes RRX, which shifts the C flag in
+    bool rrx = get_bits(instr->instruction, 11, 4) == 0x6;
+    switch (instr->op) {
+        case INSTR_ADC: case INSTR_SBC: case INSTR_RSC:
+            return true;
+        case INSTR_AND: case INSTR_EOR: case INSTR_TST: case INSTR_TEQ:
+        case INSTR_ORR: case INSTR_MOV: case INSTR_BIC: case INSTR_MVN:
+            // shifter carry might just be the old C
+            return instr->S || (!instr->I && rrx);
+        case INSTR_SUB: case INSTR_RSB: case INSTR_ADD:
+        case INSTR_CMP: case INSTR_CMN:
+            return !instr->I && rrx;
+        case INSTR_LDR: case INSTR_STR: case INSTR_LDRB: case INSTR_STRB:
+            return instr->I && rrx; // I = 1 is the register offset here
+        default:
+            return false;
+    }
 }
 
-/* So we don't do the normal SWI stuff as we have no OS, we just check if we got
- * `swi #10` and if yes, we halt processor and bye bye
+/* Shifter operands of data-processing instructions, one function per
+ * ShifterKind. The immediate comes pre-rotated from decode().
  */
-static void exec_SWI(uint32_t instruction)
+#define CPSR_CARRY ((sim->cpu.CPSR >> CPSR_C) & 1)
+#define SIGN_FILL(val) ((val) >> 31 ? 0xFFFFFFFF : 0)
+
+static inline struct ShifterOperand operand_IMM(struct Simulator *sim, const struct DecodedInstr *instr)
 {
-    uint32_t immed_24 = get_bits(instruction, 23, 0);
-    if (immed_24 == 10) {
-        next_state.halted = 1;
+    uint32_t imm = instr->imm;
+    return (struct ShifterOperand) {imm, instr->imm_rotated ? imm >> 31 : CPSR_CARRY};
+}
+
+static inline struct ShifterOperand operand_LSL_IMM(struct Simulator *sim, const struct DecodedInstr *instr)
+{
+    uint32_t rm = sim->cpu.regs[instr->rm];
+    uint8_t shift = instr->shift_imm;
+    if (shift == 0) {
+        return (struct ShifterOperand) {rm, CPSR_CARRY};
     }
+    return (struct ShifterOperand) {rm << shift, (rm >> (32 - shift)) & 1};
 }
 
-static void exec_ADC(uint32_t instruction)
-{
-    struct ShifterOperand * shiftop;
-    shiftop = shifter_operand(curr_state, instruction);
-    uint8_t rd_id = get_bits(instruction, 15, 12);
-    uint8_t rn_id = get_bits(instruction, 19, 16);
-    uint32_t rn_val = curr_state.regs[rn_id];
-    bool carry = get_bit(curr_state.CPSR, CPSR_C);
-    uint32_t rd_val = rn_val + shiftop->shifter_operand + carry;
-    next_state.regs[rd_id] = rd_val;
-    if (get_bit(instruction, S_BIT) == 1) {
-        set_bit(&next_state.CPSR, CPSR_N, get_bit(rd_val, 31));
-        set_bit(&next_state.CPSR, CPSR_Z, (rd_val ? 0 : 1));
-        set_bit(&next_state.CPSR, CPSR_C,
-                check_add_carry(rn_val, shiftop->shifter_operand + carry));
-        set_bit(&next_state.CPSR, CPSR_V,
-                check_overflow(rn_val, shiftop->shifter_operand));
+static inline struct ShifterOperand operand_LSL_REG(struct Simulator *sim, const struct DecodedInstr *instr)
+{
+    uint32_t rm = sim->cpu.regs[instr->rm];
+    uint8_t shift = sim->cpu.regs[instr->rs] & 0xFF;
+    if (shift == 0) {
+        return (struct ShifterOperand) {rm, CPSR_CARRY};
+    } else if (shift < 32) {
+        return (struct ShifterOperand) {rm << shift, (rm >> (32 - shift)) & 1};
     }
+    return (struct ShifterOperand) {0, shift == 32 ? rm & 1 : 0};
 }
 
-static void exec_ADD(uint32_t instruction)
-{
-    struct ShifterOperand * shiftop;
-    shiftop = shifter_operand(curr_state, instruction);
-    uint8_t rd_id = get_bits(instruction, 15, 12);
-    uint8_t rn_id = get_bits(instruction, 19, 16);
-    uint32_t rn_val = curr_state.regs[rn_id];
-    uint32_t rd_val = rn_val + shiftop->shifter_operand;
-    next_state.regs[rd_id] = rd_val;
-    if (get_bit(instruction, S_BIT) == 1) {
-        set_bit(&next_state.CPSR, CPSR_N, get_bit(rd_val, 31));
-        set_bit(&next_state.CPSR, CPSR_Z, (rd_val ? 0 : 1));
-        set_bit(&next_state.CPSR, CPSR_C,
-                check_add_carry(rn_val, shiftop->shifter_operand));
-        set_bit(&next_state.CPSR, CPSR_V,
-                check_overflow(rn_val, shiftop->shifter_operand));
+static inline struct ShifterOperand operand_LSR_IMM(struct Simulator *sim, const struct DecodedInstr *instr)
+{
+    uint32_t rm = sim->cpu.regs[instr->rm];
+    uint8_t shift = instr->shift_imm;
+    if (shift == 0) { // LSR #32
+        return (struct ShifterOperand) {0, rm >> 31};
     }
+    return (struct ShifterOperand) {rm >> shift, (rm >> (shift - 1)) & 1};
 }
 
-static void exec_AND(uint32_t instruction)
-{
-    struct ShifterOperand * shiftop;
-    shiftop = shifter_operand(curr_state, instruction);
-    uint8_t rd_id = get_bits(instruction, 15, 12);
-    uint8_t rn_id = get_bits(instruction, 19, 16);
-    uint32_t rn_val = curr_state.regs[rn_id];
-    uint32_t rd_val = rn_val & shiftop->shifter_operand;
-    next_state.regs[rd_id] = rd_val;
-    if (get_bit(instruction, S_BIT) == 1) {
-        set_bit(&next_state.CPSR, CPSR_N, get_bit(rd_val, 31));
-        set_bit(&next_state.CPSR, CPSR_Z, (rd_val ? 0 : 1));
-        set_bit(&next_state.CPSR, CPSR_C,shiftop->shifter_carry);
-        //flag V unaffected
+static inline struct ShifterOperand operand_LSR_REG(struct Simulator *sim, const struct DecodedInstr *instr)
+{
+    uint32_t rm = sim->cpu.regs[instr->rm];
+    uint8_t shift = sim->cpu.regs[instr->rs] & 0xFF;
+    if (shift == 0) {
+        return (struct ShifterOperand) {rm, CPSR_CARRY};
+    } else if (shift < 32) {
+        return (struct ShifterOperand) {rm >> shift, (rm >> (shift - 1)) & 1};
     }
+    return (struct ShifterOperand) {0, shift == 32 ? rm >> 31 : 0};
 }
 
-static void exec_BIC(uint32_t instruction)
-{
-    struct ShifterOperand * shiftop;
-    shiftop = shifter_operand(curr_state, instruction);
-    uint8_t rd_id = get_bits(instruction, 15, 12);
-    uint8_t rn_id = get_bits(instruction, 19, 16);
-    uint32_t rn_val = curr_state.regs[rn_id];
-    uint32_t rd_val = rn_val & !(shiftop->shifter_operand);
-    next_state.regs[rd_id] = rd_val;
-    if (get_bit(instruction, S_BIT) == 1) {
-        set_bit(&next_state.CPSR, CPSR_N, get_bit(rd_val, 31));
-        set_bit(&next_state.CPSR, CPSR_Z, (rd_val ? 0 : 1));
-        set_bit(&next_state.CPSR, CPSR_C,shiftop->shifter_carry);
-        //flag V unaffected
+static inline struct ShifterOperand operand_ASR_IMM(struct Simulator *sim, const struct DecodedInstr *instr)
+{
+    uint32_t rm = sim->cpu.regs[instr->rm];
+    uint8_t shift = instr->shift_imm;
+    if (shift == 0) { // ASR #32
+        return (struct ShifterOperand) {SIGN_FILL(rm), rm >> 31};
     }
+    return (struct ShifterOperand) {arithmetic_right_shift(rm, shift), (rm >> (shift - 1)) & 1};
 }
 
-static void exec_BL(uint32_t instruction)
+static inline struct ShifterOperand operand_ASR_REG(struct Simulator *sim, const struct DecodedInstr *instr)
 {
-    uint32_t immed_24 = get_bits(instruction, 23, 0);
-    uint8_t L = get_bit(instruction, 24);
-    if (L == 1) {
-        // addr of instruction next to B{L} instruction stored in link reg (r14)
-        next_state.regs[LR] = curr_state.regs[PC] + 4;
+    uint32_t rm = sim->cpu.regs[instr->rm];
+    uint8_t shift = sim->cpu.regs[instr->rs] & 0xFF;
+    if (shift == 0) {
+        return (struct ShifterOperand) {rm, CPSR_CARRY};
+    } else if (shift < 32) {
+        return (struct ShifterOperand) {arithmetic_right_shift(rm, shift), (rm >> (shift - 1)) & 1};
     }
-    // value in PC acc. to arm_arm pg A4-10 is <curr_instruction_address + 8>
-    // we store current_instruction_address in PC instead
-    // also we unconditionally update PC to PC + 4 in process_instruction
-    // thus for us offset = given_offset + 8 - 4 = given_offset + 4
-    int32_t offset = (int32_t)(sign_extend(immed_24, 24, 30) << 2) + 4;
-    next_state.regs[PC] += offset;
-}
-
-static void exec_RSB(uint32_t instruction)
-{
-    struct ShifterOperand * shiftop;
-    shiftop = shifter_operand(curr_state, instruction);
-    uint8_t Rdi = get_bits(instruction, 15, 12);
-    uint8_t Rni = get_bits(instruction, 19, 16);
-    uint8_t S = get_bit(instruction, 20);
-    next_state.regs[Rdi] = shiftop->shifter_operand - curr_state.regs[Rni];
-    if (S == 1) { //ignore the SPSR crap.
-        set_bit(&next_state.CPSR, CPSR_N, get_bit(curr_state.regs[Rdi], 31));
-        set_bit(&next_state.CPSR, CPSR_Z, !curr_state.regs[Rdi]);
-        set_bit(&(next_state.CPSR), CPSR_C, !check_sub_borrow(shiftop->shifter_operand, curr_state.regs[Rni]));
-        set_bit(&(next_state.CPSR), CPSR_V, check_overflow(shiftop->shifter_operand, -curr_state.regs[Rni]));
+    return (struct ShifterOperand) {SIGN_FILL(rm), rm >> 31};
+}
+
+static inline struct ShifterOperand operand_ROR_IMM(struct Simulator *sim, const struct DecodedInstr *instr)
+{
+    uint32_t rm = sim->cpu.regs[instr->rm];
+    uint8_t shift = instr->shift_imm;
+    if (shift == 0) { // rotate right with extend
+        return (struct ShifterOperand) {(CPSR_CARRY << 31) | (rm >> 1), rm & 1};
     }
+    return (struct ShifterOperand) {rotate_right(rm, shift), (rm >> (shift - 1)) & 1};
 }
 
-static void exec_SUB(uint32_t instruction)
+static inline struct ShifterOperand operand_ROR_REG(struct Simulator *sim, const struct DecodedInstr *instr)
 {
-    struct ShifterOperand * shiftop;
-    shiftop = shifter_operand(curr_state, instruction);
-    uint8_t Rdi = get_bits(instruction, 15, 12);
-    uint8_t Rni = get_bits(instruction, 19, 16);
-    uint8_t S = get_bit(instruction, 20);
-    next_state.regs[Rdi] = curr_state.regs[Rni] - shiftop->shifter_operand;
-    if (S == 1) { //ignore the SPSR crap.
-        set_bit(&next_state.CPSR, CPSR_N, get_bit(curr_state.regs[Rdi], 31));
-        set_bit(&next_state.CPSR, CPSR_Z, !curr_state.regs[Rdi]);
-        set_bit(&(next_state.CPSR), CPSR_C, !check_sub_borrow(curr_state.regs[Rni], shiftop->shifter_operand));
-        set_bit(&(next_state.CPSR), CPSR_V, check_overflow(curr_state.regs[Rni], -shiftop->shifter_operand));
+    uint32_t rm = sim->cpu.regs[instr->rm];
+    uint8_t shift = sim->cpu.regs[instr->rs] & 0xFF;
+    if (shift == 0) {
+        return (struct ShifterOperand) {rm, CPSR_CARRY};
+    } else if ((shift & 0x1F) == 0) {
+        return (struct ShifterOperand) {rm, rm >> 31};
     }
+    shift &= 0x1F;
+    return (struct ShifterOperand) {rotate_right(rm, shift), (rm >> (shift - 1)) & 1};
+}
+
+/* Semantics of the data-processing opcodes, in DataProcOpcode order.
+ * ARITH(name, op1, op2, carry_in, writes_rd) computes op1 + op2 + carry_in,
+ * subtractions add the complement. LOGIC(name, result, writes_rd) sets C to the
+ * shifter carry and keeps V. Ops that do not write Rd always set the flags.
+ * RN is the value of Rn, OP2 the shifter operand.
+ */
+#define DP_SEMANTICS \
+    LOGIC(AND, RN & OP2, 1) \
+    LOGIC(EOR, RN ^ OP2, 1) \
+    ARITH(SUB, RN, ~OP2, 1, 1) \
+    ARITH(RSB, OP2, ~RN, 1, 1) \
+    ARITH(ADD, RN, OP2, 0, 1) \
+    ARITH(ADC, RN, OP2, CPSR_CARRY, 1) \
+    ARITH(SBC, RN, ~OP2, CPSR_CARRY, 1) \
+    ARITH(RSC, OP2, ~RN, CPSR_CARRY, 1) \
+    LOGIC(TST, RN & OP2, 0) \
+    LOGIC(TEQ, RN ^ OP2, 0) \
+    ARITH(CMP, RN, ~OP2, 1, 0) \
+    ARITH(CMN, RN, OP2, 0, 0) \
+    LOGIC(ORR, RN | OP2, 1) \
+    LOGIC(MOV, OP2, 1) \
+    LOGIC(BIC, RN & ~OP2, 1) \
+    LOGIC(MVN, ~OP2, 1)
+
+#define RN sim->cpu.regs[instr->rn]
+#define OP2 shifter.shifter_operand
+
+/* dp_<op>() executes op with the given shifter operand, S is a constant in
+ * every caller so each variant only keeps the code it needs.
+ */
+#define ARITH(name, op1, op2, carry_in, writes_rd) \
+static inline void dp_##name(struct Simulator *sim, const struct DecodedInstr *instr, \
+                             struct ShifterOperand shifter, bool S) \
+{ \
+    uint32_t result = (op1) + (op2) + (carry_in); \
+    if (writes_rd) { \
+        wb_write_reg(&sim->wb, instr->rd, result); \
+    } \
+    if (S || !(writes_rd)) { \
+        set_flags_add(sim, op1, op2, carry_in, result); \
+    } \
 }
+#define LOGIC(name, expr, writes_rd) \
+static inline void dp_##name(struct Simulator *sim, const struct DecodedInstr *instr, \
+                             struct ShifterOperand shifter, bool S) \
+{ \
+    uint32_t result = (expr); \
+    if (writes_rd) { \
+        wb_write_reg(&sim->wb, instr->rd, result); \
+    } \
+    if (S || !(writes_rd)) { \
+        set_flags_logic(sim, result, shifter.shifter_carry); \
+    } \
+}
+DP_SEMANTICS
+#undef LOGIC
+#undef ARITH
+#undef OP2
+#undef RN
+
+#define V(op, kind, S) \
+static void exec_##op##_##kind##_S##S(struct Simulator *sim, const struct DecodedInstr *instr) \
+{ \
+    dp_##op(sim, instr, operand_##kind(sim, instr), S); \
+}
+#define X(op) DP_VARIANTS(op)
+DP_OPS
+#undef X
+#undef V
 
-static void exec_TEQ(uint32_t instruction)
+/* Undefined or unimplemented instruction, we just skip it */
+static void exec_UND(struct Simulator *sim, const struct DecodedInstr *instr)
 {
+}
 
-    uint32_t Rn_addr = get_bits(instruction, 19, 16);
-    struct ShifterOperand *shifter_op = shifter_operand(curr_state, instruction);
-    uint32_t op1 = curr_state.regs[Rn_addr];
-    uint32_t op2 = shifter_op->shifter_operand;
+static void exec_LDR(struct Simulator *sim, const struct DecodedInstr *instr)
+{
+    uint32_t address = ld_str_addr_mode(&sim->cpu, &sim->wb, instr);
+    uint32_t data = sim_mem_read_32(sim, address);
+    uint32_t rd_id = instr->rd;
+    wb_write_reg(&sim->wb, rd_id, data);
+}
 
-    uint32_t alu_out = op1 ^ op2;
+static void exec_STR(struct Simulator *sim, const struct DecodedInstr *instr)
+{
+    uint32_t rd_id = instr->rd;
+    uint32_t data = sim->cpu.regs[rd_id];
+    uint32_t address = ld_str_addr_mode(&sim->cpu, &sim->wb, instr);
+    sim_mem_write_32(sim, address, data);
+}
 
-    set_bit(&(next_state.CPSR), CPSR_N, get_bit(alu_out, 31));
-    set_bit(&(next_state.CPSR), CPSR_Z, !alu_out);
-    set_bit(&(next_state.CPSR), CPSR_C, shifter_op->shifter_carry);
-    //VFlag unaffected.
+static void exec_STRB(struct Simulator *sim, const struct DecodedInstr *instr)
+{
+    uint32_t rd_id = instr->rd;
+    uint8_t data = sim->cpu.regs[rd_id] & 0xff; // LSB byte of reg
+    uint32_t address = ld_str_addr_mode(&sim->cpu, &sim->wb, instr);
+    sim_mem_write_8(sim, address, data);
 }
 
-static void exec_SBC(uint32_t instruction)
+/* So we don't do the normal SWI stuff as we have no OS, we just check if we got
+ * `swi #10` and if yes, we halt processor and bye bye
+ */
+static void exec_SWI(struct Simulator *sim, const struct DecodedInstr *instr)
 {
-    struct ShifterOperand * shiftop;
-    shiftop = shifter_operand(curr_state, instruction);
-    uint8_t Rdi = get_bits(instruction, 15, 12);
-    uint8_t Rni = get_bits(instruction, 19, 16);
-    uint8_t S = get_bit(instruction, 20);
-    next_state.regs[Rdi] = curr_state.regs[Rni] - shiftop->shifter_operand - !get_bit(curr_state.CPSR, CPSR_C);
-    if (S == 1) { //ignore the SPSR crap.
-        set_bit(&next_state.CPSR, CPSR_N, get_bit(curr_state.regs[Rdi], 31));
-        set_bit(&next_state.CPSR, CPSR_Z, !curr_state.regs[Rdi]);
-        set_bit(&(next_state.CPSR), CPSR_C, !check_sub_borrow(curr_state.regs[Rni], shiftop->shifter_operand + !get_bit(curr_state.CPSR, CPSR_C)));
-        set_bit(&(next_state.CPSR), CPSR_V, check_overflow(curr_state.regs[Rni], -shiftop->shifter_operand));
+    if (instr->imm == 10) {
+        sim->wb.halted = 1;
     }
 }
 
-static void exec_LDRB(uint32_t instruction)
+static void exec_BL(struct Simulator *sim, const struct DecodedInstr *instr)
 {
-    uint8_t data = mem_read_8(ld_str_addr_mode(curr_state, &(next_state), instruction));
-    uint32_t rd_id = get_bits(instruction, 15, 12);
-    next_state.regs[rd_id] = data; // casting uint8_t to uint32_t zeros top 3 bytes on its own; done to store byte to LSB of rd_id
+    if (instr->L) {
+        // addr of instruction next to B{L} instruction stored in link reg (r14)
+        wb_write_reg(&sim->wb, LR, sim->cpu.regs[PC] + 4);
+    }
+    // offset is pre-computed in decode()
+    wb_write_reg(&sim->wb, PC, sim->cpu.regs[PC] + instr->imm);
+}
+
+static void exec_LDRB(struct Simulator *sim, const struct DecodedInstr *instr)
+{
+    uint8_t data = sim_mem_read_8(sim, ld_str_addr_mode(&sim->cpu, &sim->wb, instr));
+    uint32_t rd_id = instr->rd;
+    wb_write_reg(&sim->wb, rd_id, data); // casting uint8_t to uint32_t zeros top 3 bytes on its own; done to store byte to LSB of rd_id
 }
 
 // Multiply and Multiply-Accumulate Instructions
@@ -404,63 +642,31 @@ static void exec_LDRB(uint32_t instruction)
 // TIL: The results of a signed multiply and an unsigned multiply
 // differ only in the upper 32 bits; the low 32 bits remain the same for both.
 // So we can use the MUL and MLA ops unchanged for signed and unsigned operands.
-static void exec_MUL(uint32_t instruction)
+static void exec_MUL(struct Simulator *sim, const struct DecodedInstr *instr)
 {
-    uint32_t rd_id = get_bits(instruction, 19, 16);
-    uint32_t rs_id = get_bits(instruction, 11, 8);
-    uint32_t rm_id = get_bits(instruction, 3, 0);
+    uint32_t rd_id = instr->rd;
+    uint32_t rs_id = instr->rs;
+    uint32_t rm_id = instr->rm;
 
-    uint32_t result = curr_state.regs[rm_id] * curr_state.regs[rs_id]; // we don't care about overflows; no need to set C(arry) flag
-    next_state.regs[rd_id] = result;
+    uint32_t result = sim->cpu.regs[rm_id] * sim->cpu.regs[rs_id]; // we don't care about overflows; no need to set C(arry) flag
+    wb_write_reg(&sim->wb, rd_id, result);
     
-    if (get_bit(instruction, S_BIT)) {
-        set_bit(&(next_state.CPSR), CPSR_N, get_bit(result, 31));
-        set_bit(&(next_state.CPSR), CPSR_Z, ((result) ? 0 : 1));
+    if (instr->S) {
+        set_flags_mul(sim, result);
     }
 }
 
-static void exec_MLA(uint32_t instruction)
+static void exec_MLA(struct Simulator *sim, const struct DecodedInstr *instr)
 {
-    uint32_t rd_id = get_bits(instruction, 19, 16);
-    uint32_t rn_id = get_bits(instruction, 15, 12);
-    uint32_t rs_id = get_bits(instruction, 11, 8);
-    uint32_t rm_id = get_bits(instruction, 3, 0);
+    uint32_t rd_id = instr->rd;
+    uint32_t rn_id = instr->rn;
+    uint32_t rs_id = instr->rs;
+    uint32_t rm_id = instr->rm;
 
-    uint32_t result = (curr_state.regs[rm_id] * curr_state.regs[rs_id]) + curr_state.regs[rn_id]; // we don't care about overflows; no need to set C(arry) flag
-    next_state.regs[rd_id] = result;
+    uint32_t result = (sim->cpu.regs[rm_id] * sim->cpu.regs[rs_id]) + sim->cpu.regs[rn_id]; // we don't care about overflows; no need to set C(arry) flag
+    wb_write_reg(&sim->wb, rd_id, result);
     
-    if (get_bit(instruction, S_BIT)) {
-        set_bit(&(next_state.CPSR), CPSR_N, get_bit(result, 31));
-        set_bit(&(next_state.CPSR), CPSR_Z, ((result) ? 0 : 1));
-    }
-}
-
-static void exec_MOV(uint32_t instruction)
-{
-    struct ShifterOperand * shiftop;
-    shiftop = shifter_operand(curr_state, instruction);
-    uint32_t val = shiftop->shifter_operand;
-    uint32_t rd_id = get_bits(instruction, 15, 12);
-    next_state.regs[rd_id] = val;
-
-    if (get_bit(instruction, S_BIT)) {
-        set_bit(&(next_state.CPSR), CPSR_N, get_bit(val, 31));
-        set_bit(&(next_state.CPSR), CPSR_Z, ((val) ? 0 : 1));
-        set_bit(&(next_state.CPSR), CPSR_C, shiftop->shifter_carry);
-    }
-}
-
-static void exec_MVN(uint32_t instruction)
-{
-    struct ShifterOperand * shiftop;
-    shiftop = shifter_operand(curr_state, instruction);
-    uint32_t val = ~(shiftop->shifter_operand) & 0xFFFFFFFF; // bitwise negation promotes result to (int); bitwise and-ing done to prevent this
-    uint32_t rd_id = get_bits(instruction, 15, 12);
-    next_state.regs[rd_id] = val;
-
-    if (get_bit(instruction, S_BIT)) {
-        set_bit(&(next_state.CPSR), CPSR_N, get_bit(val, 31));
-        set_bit(&(next_state.CPSR), CPSR_Z, ((val) ? 0 : 1));
-        set_bit(&(next_state.CPSR), CPSR_C, shiftop->shifter_carry);
+    if (instr->S) {
+        set_flags_mul(sim, result);
     }
 }
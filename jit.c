@@ -0,0 +1,985 @@
+#define _DEFAULT_SOURCE // for MAP_ANONYMOUS
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jit.h"
+#include "isa.h"
+#include "isa_helper.h"
+#include "block.h"
+#include "simulator.h"
+
+#if defined(__x86_64__)
+
+#include <sys/mman.h>
+
+/* Translated blocks run on a small calling convention of their own: rbx holds
+ * sim, r12 sim->mem_base and r13 the number of guest instructions left in the
+ * budget. Each block starts by checking r13 and charging itself to it, so
+ * blocks can jump straight into each other; the enter stub sets the registers
+ * up and the exit stub returns what is left of the budget. Data-processing,
+ * multiply, load, store and branch instructions become native x86-64 code,
+ * conditional or not, everything else is a call to isa_execute_decoded(), so
+ * translated code always leaves the same state behind as the interpreter.
+ *
+ * Flags stay lazy like in the interpreter: flag-setting instructions fill in
+ * sim->lazy, and the translator remembers what the host flags and sim->lazy
+ * hold so that conditions right after a compare are a single jcc.
+ *
+ * Executed counts of unconditional native instructions are added once at
+ * block entry, jit_abandon() takes back the ones a guest fault skips.
+ *
+ * The code buffer is never writable and executable at once: it is switched
+ * to read-write while a block is emitted or a jump gets patched, and back to
+ * read-execute before any translated code runs.
+ */
+typedef uint64_t (*JitEnter)(struct Simulator *sim, uint64_t budget, const uint8_t *code);
+
+struct JitBlock {
+    const uint8_t *code; ///> NULL until translated
+    uint32_t nb_instr; ///> Number of guest instructions in block, 0 if not discovered yet
+    uint32_t heat; ///> Times the block was entered from the dispatcher
+};
+
+#define JIT_CODE_SIZE (32 << 20)
+// upper bounds of emitted bytes, per guest instruction and per block
+#define JIT_INSTR_BYTES 768
+#define JIT_BLOCK_BYTES 512
+
+#define SIM_DISP(field) ((int32_t) offsetof(struct Simulator, field))
+#define REG_DISP(r) (SIM_DISP(cpu.regs) + 4 * (r))
+#define EXECUTED_DISP(op) (SIM_DISP(stats.executed) + (int32_t) sizeof(uint64_t) * (op))
+#define COND_FAILED_DISP(op) (SIM_DISP(stats.cond_failed) + (int32_t) sizeof(uint64_t) * (op))
+
+struct JitCache {
+    // one slot per word of the text region, indexed by (PC - MEM_TEXT_START) / 4
+    struct JitBlock blocks[MEM_TEXT_SIZE / 4];
+    uint8_t covered[MEM_TEXT_SIZE / 4]; ///> 1 if word is part of a block
+    uint8_t *code_buf; ///> executable buffer, NULL if not mapped yet
+    size_t code_used;
+    size_t code_start; ///> size of the stubs at the start of code_buf
+    JitEnter enter; ///> stub running translated code
+    const uint8_t *exit_stub; ///> where translated code jumps to return
+    /** Jump of the last block exit, still to be linked to its target, or NULL */
+    uint8_t *exit_site;
+    uint32_t entered; ///> start of the translated block last entered
+    uint8_t in_code; ///> set while translated code runs
+    /** Set when a translated word gets written, makes running code bail out */
+    volatile uint8_t code_modified;
+    uint32_t used; ///> slots from here on are all empty, keeps flushes short
+};
+
+/** Where translate() emits the next byte, per thread as each one may be
+ * translating for its own simulator.
+ */
+static __thread uint8_t *emit_ptr;
+
+enum HostReg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI };
+
+/** Shift types, as encoded in bits 6-5 of ARM instructions */
+enum ShiftType { SHIFT_LSL, SHIFT_LSR, SHIFT_ASR, SHIFT_ROR };
+
+enum HostCond {
+    CC_O, CC_NO, CC_B, CC_AE, CC_E, CC_NE, CC_BE, CC_A,
+    CC_S, CC_NS, CC_P, CC_NP, CC_L, CC_GE, CC_LE, CC_G
+};
+
+/** What translated code knows about the flags at some point of a block */
+enum KnownFlags {
+    KNOWN_NOTHING,
+    KNOWN_SYNCED, ///> all in CPSR, nothing pending
+    KNOWN_SUB, ///> a subtraction of a native instruction is pending
+    KNOWN_ADD, ///> an addition of a native instruction is pending
+    KNOWN_RESULT, ///> a logical op or multiply is pending, N and Z come from result
+};
+
+struct Translation {
+    struct JitCache *jit;
+    uint32_t pc; ///> address of the first instruction
+    uint32_t nb_instr;
+    const struct DecodedInstr *instrs[BLOCK_MAX_INSTR];
+    bool native[BLOCK_MAX_INSTR]; ///> translated to native code rather than a call
+    enum KnownFlags live; ///> what the host flags hold
+    enum KnownFlags lazy; ///> what sim->lazy and CPSR hold
+};
+
+static void emit8(uint8_t byte)
+{
+    *emit_ptr++ = byte;
+}
+
+static void emit32(uint32_t word)
+{
+    memcpy(emit_ptr, &word, 4);
+    emit_ptr += 4;
+}
+
+static void emit64(uint64_t dword)
+{
+    memcpy(emit_ptr, &dword, 8);
+    emit_ptr += 8;
+}
+
+/** ModRM and displacement of [rbx + disp], reg goes in the reg field */
+static void emit_rbx(uint8_t reg, int32_t disp)
+{
+    if (disp >= -128 && disp <= 127) {
+        emit8(0x43 | reg << 3); emit8((uint8_t) disp);
+    } else {
+        emit8(0x83 | reg << 3); emit32(disp);
+    }
+}
+
+/** mov reg, [rbx + disp] */
+static void emit_load(uint8_t reg, int32_t disp)
+{
+    emit8(0x8b); emit_rbx(reg, disp);
+}
+
+/** mov [rbx + disp], reg */
+static void emit_store(uint8_t reg, int32_t disp)
+{
+    emit8(0x89); emit_rbx(reg, disp);
+}
+
+/** mov byte [rbx + disp], reg */
+static void emit_store8(uint8_t reg, int32_t disp)
+{
+    emit8(0x88); emit_rbx(reg, disp);
+}
+
+/** mov dword [rbx + disp], imm */
+static void emit_store_imm(int32_t disp, uint32_t imm)
+{
+    emit8(0xc7); emit_rbx(0, disp); emit32(imm);
+}
+
+/** mov byte [rbx + disp], imm */
+static void emit_store_imm8(int32_t disp, uint8_t imm)
+{
+    emit8(0xc6); emit_rbx(0, disp); emit8(imm);
+}
+
+/** add qword [rbx + disp], value */
+static void emit_add_u64(int32_t disp, int32_t value)
+{
+    emit8(0x48); emit8(0x81); emit_rbx(0, disp); emit32(value);
+}
+
+/** mov reg, imm */
+static void emit_mov_imm(uint8_t reg, uint32_t imm)
+{
+    emit8(0xb8 + reg); emit32(imm);
+}
+
+/** opcode dst, src for an ALU opcode taking r/m32, r32: 0x01 add, 0x09 or,
+ * 0x21 and, 0x29 sub, 0x31 xor, 0x85 test, 0x89 mov
+ */
+static void emit_alu(uint8_t opcode, uint8_t dst, uint8_t src)
+{
+    emit8(opcode); emit8(0xc0 | src << 3 | dst);
+}
+
+/** ext reg, imm for the 0x81 group: 0 add, 4 and, 5 sub, 7 cmp */
+static void emit_alu_imm(uint8_t ext, uint8_t reg, uint32_t imm)
+{
+    emit8(0x81); emit8(0xc0 | ext << 3 | reg); emit32(imm);
+}
+
+/** Shift reg by amount, the host way of enum ShiftType */
+static void emit_shift(uint8_t type, uint8_t reg, uint8_t amount)
+{
+    static const uint8_t ext[] = {4, 5, 7, 1}; // shl, shr, sar, ror
+    emit8(0xc1); emit8(0xc0 | ext[type] << 3 | reg); emit8(amount);
+}
+
+/** not reg */
+static void emit_not(uint8_t reg)
+{
+    emit8(0xf7); emit8(0xd0 | reg);
+}
+
+/** bswap reg */
+static void emit_bswap(uint8_t reg)
+{
+    emit8(0x0f); emit8(0xc8 + reg);
+}
+
+/** jcc rel32, to be patched
+ * \return where the rel32 goes
+ */
+static uint8_t * emit_jcc(uint8_t cc)
+{
+    emit8(0x0f); emit8(0x80 | cc); emit32(0);
+    return emit_ptr - 4;
+}
+
+/** jmp rel32, to be patched
+ * \return where the rel32 goes
+ */
+static uint8_t * emit_jmp()
+{
+    emit8(0xe9); emit32(0);
+    return emit_ptr - 4;
+}
+
+/** Make the jump whose rel32 is at site land on target */
+static void patch(uint8_t *site, const uint8_t *target)
+{
+    int32_t rel = target - (site + 4);
+    memcpy(site, &rel, 4);
+}
+
+/** Call fn with sim as first argument, further arguments are already in place */
+static void emit_call(const void *fn)
+{
+    emit8(0x48); emit8(0x89); emit8(0xdf); // mov rdi, rbx
+    emit8(0x48); emit8(0xb8); emit64((uintptr_t) fn); // mov rax, imm64
+    emit8(0xff); emit8(0xd0); // call rax
+}
+
+/** Load guest register r into reg, PC reads are the address of the instruction */
+static void emit_read_reg(uint8_t reg, uint8_t r, uint32_t pc)
+{
+    if (r == PC) {
+        emit_mov_imm(reg, pc);
+    } else {
+        emit_load(reg, REG_DISP(r));
+    }
+}
+
+/** Return to the dispatcher with nothing to link */
+static void emit_return(const struct Translation *t)
+{
+    emit8(0x31); emit8(0xc0); // xor eax, eax
+    patch(emit_jmp(), t->jit->exit_stub);
+}
+
+/** Leave the block for target. The jump falls through to the exit stub until
+ * jit_run() links it to the block at target.
+ */
+static void emit_exit(const struct Translation *t, uint32_t target)
+{
+    emit_store_imm(REG_DISP(PC), target);
+    uint8_t *site = emit_jmp();
+    patch(site, emit_ptr);
+    emit8(0x48); emit8(0xb8); emit64((uintptr_t) site); // mov rax, imm64
+    patch(emit_jmp(), t->jit->exit_stub);
+}
+
+static bool counted_at_entry(const struct Translation *t, uint32_t i)
+{
+    return t->native[i] && condition_always(t->instrs[i]->cond);
+}
+
+/** Add sign times the executed counts of the instructions from first on that
+ * are counted at block entry
+ */
+static void emit_entry_counts(const struct Translation *t, uint32_t first, int32_t sign)
+{
+    int32_t counts[NB_INSTR_OPS] = {0};
+    for (uint32_t i = first; i < t->nb_instr; i++) {
+        if (counted_at_entry(t, i)) {
+            counts[t->instrs[i]->op]++;
+        }
+    }
+    for (int op = 0; op < NB_INSTR_OPS; op++) {
+        if (counts[op] != 0) {
+            emit_add_u64(EXECUTED_DISP(op), sign * counts[op]);
+        }
+    }
+}
+
+/** Return to the dispatcher after instruction i, because it modified code */
+static void emit_early_exit(const struct Translation *t, uint32_t i, bool set_pc)
+{
+    emit_entry_counts(t, i + 1, -1);
+    emit8(0x49); emit8(0x81); emit8(0xc5); emit32(t->nb_instr - i - 1); // add r13, imm32
+    if (set_pc) {
+        emit_store_imm(REG_DISP(PC), t->pc + 4 * i + 4);
+    }
+    emit_return(t);
+}
+
+/** Jump if the last store did not hit translated code, patch the result */
+static uint8_t * emit_unmodified_check(const struct Translation *t)
+{
+    emit8(0x48); emit8(0xb8); emit64((uintptr_t) &t->jit->code_modified); // mov rax, imm64
+    emit8(0x80); emit8(0x38); emit8(0x00); // cmp byte [rax], 0
+    return emit_jcc(CC_E);
+}
+
+/** Materialize the flags and check cond, for translated code */
+static uint32_t check_condition(struct Simulator *sim, uint8_t cond)
+{
+    isa_sync_flags(sim);
+    return condition_check(&sim->cpu, cond);
+}
+
+/** Host condition code equivalent to ARM cond with the flags of kind
+ * \return -1 if there is none
+ */
+static int host_condition(enum KnownFlags kind, uint8_t cond)
+{
+    static const int8_t sub[] = {
+        CC_E, CC_NE, CC_AE, CC_B, CC_S, CC_NS, CC_O, CC_NO, CC_A, CC_BE, CC_GE, CC_L, CC_G, CC_LE,
+    };
+    static const int8_t add[] = {
+        CC_E, CC_NE, CC_B, CC_AE, CC_S, CC_NS, CC_O, CC_NO, -1, -1, CC_GE, CC_L, CC_G, CC_LE,
+    };
+    static const int8_t result[] = {
+        CC_E, CC_NE, -1, -1, CC_S, CC_NS, -1, -1, -1, -1, -1, -1, -1, -1,
+    };
+    if (cond >= COND_AL) {
+        return -1;
+    }
+    switch (kind) {
+        case KNOWN_SUB: return sub[cond];
+        case KNOWN_ADD: return add[cond];
+        case KNOWN_RESULT: return result[cond];
+        default: return -1;
+    }
+}
+
+/** Emit the check of cond.
+ * \return jump to be patched, taken if cond fails
+ */
+static uint8_t * emit_condition(struct Translation *t, uint8_t cond)
+{
+    int cc = host_condition(t->live, cond);
+    if (cc < 0 && (cc = host_condition(t->lazy, cond)) >= 0) {
+        // redo the pending operation for the host flags
+        switch (t->lazy) {
+            case KNOWN_SUB:
+                emit_load(RAX, SIM_DISP(lazy.op1));
+                emit_load(RCX, SIM_DISP(lazy.op2));
+                emit_not(RCX);
+                emit_alu(0x39, RAX, RCX); // cmp eax, ecx
+                break;
+            case KNOWN_ADD:
+                emit_load(RAX, SIM_DISP(lazy.op1));
+                emit8(0x03); emit_rbx(RAX, SIM_DISP(lazy.op2)); // add eax, [rbx + op2]
+                break;
+            default:
+                emit_load(RAX, SIM_DISP(lazy.result));
+                emit_alu(0x85, RAX, RAX);
+                break;
+        }
+        t->live = t->lazy;
+    }
+    if (cc < 0 && t->lazy == KNOWN_SYNCED) {
+        // bit NZCV of condition_table[cond]
+        emit_load(RAX, SIM_DISP(cpu.CPSR));
+        emit_shift(SHIFT_LSR, RAX, CPSR_V);
+        emit_mov_imm(RCX, condition_table[cond]);
+        emit8(0x0f); emit8(0xa3); emit8(0xc1); // bt ecx, eax
+        cc = CC_B;
+    }
+    if (cc < 0) {
+        emit_mov_imm(RSI, cond);
+        emit_call(check_condition);
+        emit_alu(0x85, RAX, RAX);
+        cc = CC_NE;
+        t->lazy = KNOWN_SYNCED;
+    }
+    return emit_jcc(cc ^ 1);
+}
+
+/** Bring CPSR up to date unless what is pending gets overwritten anyway.
+ * \param keeps_carry the pending C flag must survive
+ */
+static void emit_flags_sync(struct Translation *t, bool keeps_carry)
+{
+    if (t->lazy == KNOWN_SYNCED || (t->lazy == KNOWN_RESULT && !keeps_carry)) {
+        return;
+    }
+    emit_call(isa_sync_flags);
+    t->lazy = KNOWN_SYNCED;
+}
+
+/** Load register rm shifted by an immediate, as encoded in bits 6-5 and 11-7
+ * of instruction, into ecx. The shifter carry goes to dl if wanted, unless
+ * it is the old C flag. RRX is not supported.
+ */
+static void emit_shifted_reg(uint32_t instruction, uint8_t rm, uint32_t pc, bool carry)
+{
+    uint8_t type = get_bits(instruction, 6, 5);
+    uint8_t amount = get_bits(instruction, 11, 7);
+    emit_read_reg(RCX, rm, pc);
+    if (amount != 0) {
+        emit_shift(type, RCX, amount);
+        if (carry) {
+            emit8(0x0f); emit8(0x92); emit8(0xc2); // setc dl
+        }
+    } else if (type == SHIFT_LSR) { // LSR #32
+        if (carry) {
+            emit_alu(0x89, RDX, RCX);
+            emit_shift(SHIFT_LSR, RDX, 31);
+        }
+        emit_alu(0x31, RCX, RCX);
+    } else if (type == SHIFT_ASR) { // ASR #32
+        emit_shift(SHIFT_ASR, RCX, 31);
+        if (carry) {
+            emit_alu(0x89, RDX, RCX);
+            emit_alu_imm(4, RDX, 1);
+        }
+    }
+}
+
+/** True if the shifter carry of data-processing instr is the old C flag */
+static bool shifter_keeps_carry(const struct DecodedInstr *instr)
+{
+    if (instr->I) {
+        return !instr->imm_rotated;
+    }
+    return get_bits(instr->instruction, 11, 5) == 0; // LSL #0
+}
+
+static bool is_logic(uint8_t op)
+{
+    switch (op) {
+        case INSTR_AND: case INSTR_EOR: case INSTR_TST: case INSTR_TEQ:
+        case INSTR_ORR: case INSTR_MOV: case INSTR_BIC: case INSTR_MVN:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool writes_rd(uint8_t op)
+{
+    return op < INSTR_TST || op > INSTR_CMN;
+}
+
+/** True if instr can be translated to native code */
+static bool native_supported(const struct DecodedInstr *instr)
+{
+    bool rrx = get_bits(instr->instruction, 11, 4) == 0x6;
+    switch (instr->op) {
+        case INSTR_ADC: case INSTR_SBC: case INSTR_RSC: case INSTR_SWI:
+            return false;
+        case INSTR_LDR: case INSTR_STR: case INSTR_LDRB: case INSTR_STRB:
+            if (!instr->P && instr->W) { // user mode access
+                return false;
+            }
+            if (instr->rn == PC && (!instr->P || instr->W)) {
+                return false;
+            }
+            return !(instr->L && instr->rd == PC) && !(instr->I && rrx);
+        case INSTR_MUL: case INSTR_MLA:
+            return instr->rd != PC;
+        case INSTR_BL: case INSTR_UND:
+            return true;
+        default: // data processing, register shifts stay interpreted
+            if (writes_rd(instr->op) && instr->rd == PC) {
+                return false;
+            }
+            return instr->I || (!get_bit(instr->instruction, 4) && !rrx);
+    }
+}
+
+/** True if instr changes sim->lazy */
+static bool sets_flags(const struct DecodedInstr *instr)
+{
+    if (instr->op <= INSTR_MVN) {
+        return instr->S || !writes_rd(instr->op);
+    }
+    return (instr->op == INSTR_MUL || instr->op == INSTR_MLA) && instr->S;
+}
+
+static void emit_data_processing(struct Translation *t, const struct DecodedInstr *instr, uint32_t pc)
+{
+    uint8_t op = instr->op;
+    bool S = sets_flags(instr);
+    if (!is_logic(op)) { // SUB, RSB, ADD, CMP and CMN
+        bool sub = op != INSTR_ADD && op != INSTR_CMN;
+        if (instr->I) {
+            emit_mov_imm(RCX, instr->imm);
+        } else {
+            emit_shifted_reg(instr->instruction, instr->rm, pc, false);
+        }
+        emit_read_reg(RAX, instr->rn, pc);
+        uint8_t op1 = op == INSTR_RSB ? RCX : RAX;
+        uint8_t op2 = op == INSTR_RSB ? RAX : RCX;
+        if (S) {
+            emit_store(op1, SIM_DISP(lazy.op1));
+            emit_alu(0x89, RDX, op2);
+            if (sub) {
+                emit_not(RDX);
+            }
+            emit_store(RDX, SIM_DISP(lazy.op2));
+        }
+        emit_alu(sub ? 0x29 : 0x01, op1, op2);
+        if (writes_rd(op)) {
+            emit_store(op1, REG_DISP(instr->rd));
+        }
+        if (S) {
+            emit_store(op1, SIM_DISP(lazy.result));
+            emit_store_imm8(SIM_DISP(lazy.carry), sub);
+            emit_store_imm8(SIM_DISP(lazy.kind), FLAGS_ADD);
+            t->live = t->lazy = sub ? KNOWN_SUB : KNOWN_ADD;
+        }
+        return;
+    }
+
+    bool old_carry = S && shifter_keeps_carry(instr);
+    if (S) {
+        emit_flags_sync(t, old_carry); // V, and maybe C, may still be pending
+    }
+    if (instr->I) {
+        emit_mov_imm(RCX, instr->imm);
+        if (S && !old_carry) {
+            emit_mov_imm(RDX, instr->imm >> 31);
+        }
+    } else {
+        emit_shifted_reg(instr->instruction, instr->rm, pc, S);
+    }
+    if (old_carry) {
+        emit_load(RDX, SIM_DISP(cpu.CPSR));
+        emit_shift(SHIFT_LSR, RDX, CPSR_C);
+        emit_alu_imm(4, RDX, 1);
+    }
+    if (op != INSTR_MOV && op != INSTR_MVN) {
+        emit_read_reg(RAX, instr->rn, pc);
+    }
+    switch (op) {
+        case INSTR_AND: case INSTR_TST: emit_alu(0x21, RAX, RCX); break;
+        case INSTR_EOR: case INSTR_TEQ: emit_alu(0x31, RAX, RCX); break;
+        case INSTR_ORR: emit_alu(0x09, RAX, RCX); break;
+        case INSTR_BIC: emit_not(RCX); emit_alu(0x21, RAX, RCX); break;
+        case INSTR_MVN: emit_not(RCX); // fall through
+        default: emit_alu(0x89, RAX, RCX); break; // MOV
+    }
+    if (writes_rd(op)) {
+        emit_store(RAX, REG_DISP(instr->rd));
+    }
+    if (S) {
+        if (op == INSTR_MOV || op == INSTR_MVN) {
+            emit_alu(0x85, RAX, RAX);
+        }
+        emit_store(RAX, SIM_DISP(lazy.result));
+        emit_store8(RDX, SIM_DISP(lazy.carry));
+        emit_store_imm8(SIM_DISP(lazy.kind), FLAGS_LOGIC);
+        t->live = t->lazy = KNOWN_RESULT;
+    }
+}
+
+static void emit_multiply(struct Translation *t, const struct DecodedInstr *instr, uint32_t pc)
+{
+    if (instr->S) {
+        emit_flags_sync(t, true);
+    }
+    emit_read_reg(RAX, instr->rm, pc);
+    emit_read_reg(RCX, instr->rs, pc);
+    emit8(0x0f); emit8(0xaf); emit8(0xc1); // imul eax, ecx
+    if (instr->op == INSTR_MLA) {
+        emit_read_reg(RDX, instr->rn, pc);
+        emit_alu(0x01, RAX, RDX);
+    }
+    emit_store(RAX, REG_DISP(instr->rd));
+    if (instr->S) {
+        emit_alu(0x85, RAX, RAX);
+        emit_store(RAX, SIM_DISP(lazy.result));
+        emit_store_imm8(SIM_DISP(lazy.kind), FLAGS_MUL);
+        t->live = t->lazy = KNOWN_RESULT;
+    }
+}
+
+/** ModRM and SIB of [r12 + address], reg goes in the reg field */
+static void emit_host_address(uint8_t reg, uint8_t address)
+{
+    emit8(0x04 | reg << 3); emit8(address << 3 | 0x04);
+}
+
+/** Write the base register back from esi, if the addressing mode does */
+static void emit_writeback(const struct DecodedInstr *instr)
+{
+    if (!instr->P || instr->W) {
+        emit_store(RSI, REG_DISP(instr->rn));
+    }
+}
+
+/** Set the bit of the page containing address in sim->written */
+static void emit_mark_written(uint8_t address)
+{
+    emit_alu(0x89, RCX, address);
+    emit_shift(SHIFT_LSR, RCX, MEM_PAGE_BITS);
+    emit_alu(0x89, RDI, RCX);
+    emit_shift(SHIFT_LSR, RDI, 3);
+    emit_alu_imm(4, RCX, 7);
+    emit_mov_imm(RAX, 1);
+    emit8(0xd3); emit8(0xe0); // shl eax, cl
+    emit8(0x08); emit8(0x84); emit8(0x3b); emit32(SIM_DISP(written)); // or [rbx + rdi + disp32], al
+}
+
+/** Loads and stores access guest memory through r12, a fault goes to the
+ * recovery of sim_cpu_run*() like in the interpreter. Stores to the text
+ * region or unaligned words go through sim_mem_write_*().
+ */
+static void emit_load_store(struct Translation *t, uint32_t i)
+{
+    const struct DecodedInstr *instr = t->instrs[i];
+    uint32_t pc = t->pc + 4 * i;
+    bool byte = instr->op == INSTR_LDRB || instr->op == INSTR_STRB;
+    if (!instr->L) {
+        emit_read_reg(RDX, instr->rd, pc);
+        if (byte) {
+            emit8(0x0f); emit8(0xb6); emit8(0xd2); // movzx edx, dl
+        }
+    }
+    if (instr->I) {
+        emit_shifted_reg(instr->instruction, instr->rm, pc, false);
+    }
+    emit_read_reg(RAX, instr->rn, pc);
+    emit_alu(0x89, RSI, RAX);
+    if (instr->I) {
+        emit_alu(instr->U ? 0x01 : 0x29, RSI, RCX);
+    } else if (instr->imm != 0) {
+        emit_alu_imm(instr->U ? 0 : 5, RSI, instr->imm);
+    }
+    uint8_t address = instr->P ? RSI : RAX;
+    emit_store_imm(REG_DISP(PC), pc); // where a fault leaves PC
+
+    if (instr->L) {
+        emit8(0x41);
+        if (byte) {
+            emit8(0x0f); emit8(0xb6); // movzx edx, byte [r12 + address]
+        } else {
+            emit8(0x8b); // mov edx, [r12 + address]
+        }
+        emit_host_address(RDX, address);
+        if (!byte) {
+            emit_bswap(RDX);
+        }
+        emit_writeback(instr);
+        emit_store(RDX, REG_DISP(instr->rd));
+        return;
+    }
+
+    uint8_t *unaligned = NULL;
+    if (!byte) {
+        emit8(0xf7); emit8(0xc0 | address); emit32(3); // test address, 3
+        unaligned = emit_jcc(CC_NE);
+    }
+    emit_alu(0x89, RCX, address);
+    if (MEM_TEXT_START != 0) {
+        emit_alu_imm(5, RCX, MEM_TEXT_START);
+    }
+    emit_alu_imm(7, RCX, MEM_TEXT_SIZE);
+    uint8_t *text = emit_jcc(CC_B);
+    if (!byte) {
+        emit_bswap(RDX);
+    }
+    emit8(0x41); emit8(byte ? 0x88 : 0x89); emit_host_address(RDX, address);
+    emit_mark_written(address);
+    uint8_t *done = emit_jmp();
+
+    if (unaligned != NULL) {
+        patch(unaligned, emit_ptr);
+    }
+    patch(text, emit_ptr);
+    emit8(0x56); emit8(0x56); // push rsi twice, keeping the stack aligned
+    if (address != RSI) {
+        emit_alu(0x89, RSI, address);
+    }
+    emit_call(byte ? (const void *) sim_mem_write_8 : (const void *) sim_mem_write_32);
+    emit8(0x5e); emit8(0x5e); // pop rsi twice
+    uint8_t *unmodified = emit_unmodified_check(t);
+    emit_writeback(instr);
+    emit_early_exit(t, i, true);
+    patch(unmodified, emit_ptr);
+    patch(done, emit_ptr);
+    emit_writeback(instr);
+}
+
+/** Emit native code for instruction i of the block */
+static void emit_native(struct Translation *t, uint32_t i)
+{
+    const struct DecodedInstr *instr = t->instrs[i];
+    uint32_t pc = t->pc + 4 * i;
+    bool conditional = !condition_always(instr->cond);
+    uint8_t *failed = NULL;
+    if (conditional) {
+        failed = emit_condition(t, instr->cond);
+        emit_add_u64(EXECUTED_DISP(instr->op), 1);
+    }
+    enum KnownFlags lazy = t->lazy;
+    t->live = KNOWN_NOTHING;
+    switch (instr->op) {
+        case INSTR_LDR: case INSTR_STR: case INSTR_LDRB: case INSTR_STRB:
+            emit_load_store(t, i);
+            break;
+        case INSTR_MUL: case INSTR_MLA:
+            emit_multiply(t, instr, pc);
+            break;
+        case INSTR_BL:
+            if (instr->L) {
+                emit_store_imm(REG_DISP(LR), pc + 4);
+            }
+            emit_exit(t, pc + instr->imm + 4); // imm leaves out the increment of PC
+            break;
+        case INSTR_UND:
+            break;
+        default:
+            emit_data_processing(t, instr, pc);
+            break;
+    }
+    if (conditional) {
+        uint8_t *over = emit_jmp();
+        patch(failed, emit_ptr);
+        emit_add_u64(COND_FAILED_DISP(instr->op), 1);
+        patch(over, emit_ptr);
+        t->live = KNOWN_NOTHING;
+        t->lazy = sets_flags(instr) ? KNOWN_NOTHING : lazy;
+    }
+}
+
+/** Emit a call of isa_execute_decoded() for instruction i of the block */
+static void emit_fallback(struct Translation *t, uint32_t i)
+{
+    const struct DecodedInstr *instr = t->instrs[i];
+    emit_store_imm(REG_DISP(PC), t->pc + 4 * i);
+    emit8(0x48); emit8(0xbe); emit64((uintptr_t) instr); // mov rsi, imm64
+    emit_call(isa_execute_decoded);
+    if (instr->op == INSTR_STR || instr->op == INSTR_STRB) {
+        uint8_t *unmodified = emit_unmodified_check(t);
+        emit_early_exit(t, i, false);
+        patch(unmodified, emit_ptr);
+    }
+    t->live = t->lazy = KNOWN_NOTHING;
+}
+
+/** Emit the enter and exit stubs at the start of the code buffer */
+static void emit_stubs(struct JitCache *jit)
+{
+    emit_ptr = jit->code_buf;
+    jit->enter = (JitEnter) (void *) emit_ptr;
+    emit8(0x53); // push rbx
+    emit8(0x41); emit8(0x54); // push r12
+    emit8(0x41); emit8(0x55); // push r13
+    emit8(0x48); emit8(0x89); emit8(0xfb); // mov rbx, rdi
+    emit8(0x4c); emit8(0x8b); emit8(0xa3); emit32(SIM_DISP(mem_base)); // mov r12, [rbx + disp32]
+    emit8(0x49); emit8(0x89); emit8(0xf5); // mov r13, rsi
+    emit8(0xff); emit8(0xe2); // jmp rdx
+
+    jit->exit_stub = emit_ptr;
+    emit8(0x48); emit8(0xba); emit64((uintptr_t) &jit->exit_site); // mov rdx, imm64
+    emit8(0x48); emit8(0x89); emit8(0x02); // mov [rdx], rax
+    emit8(0x4c); emit8(0x89); emit8(0xe8); // mov rax, r13
+    emit8(0x41); emit8(0x5d); // pop r13
+    emit8(0x41); emit8(0x5c); // pop r12
+    emit8(0x5b); // pop rbx
+    emit8(0xc3); // ret
+    jit->code_start = jit->code_used = emit_ptr - jit->code_buf;
+}
+
+/** Return block starting at pc, discovering it on first use.
+ * \return NULL if pc is outside the text region or unaligned
+ */
+static struct JitBlock * lookup(struct Simulator *sim, uint32_t pc)
+{
+    struct JitCache *jit = sim->jit;
+    uint32_t offset = pc - MEM_TEXT_START;
+    if (offset >= MEM_TEXT_SIZE || (offset & 0x3)) {
+        return NULL;
+    }
+    struct JitBlock *block = &jit->blocks[offset >> 2];
+    if (block->nb_instr == 0) {
+        block->nb_instr = block_length(sim, pc);
+        memset(&jit->covered[offset >> 2], 1, block->nb_instr);
+        if ((offset >> 2) + block->nb_instr > jit->used) {
+            jit->used = (offset >> 2) + block->nb_instr;
+        }
+    }
+    return block;
+}
+
+/** Make the code buffer writable and not executable, or the other way
+ * round, so that host code never runs from writable memory
+ * \return 0 on success, -1 on failure
+ */
+static int set_writable(struct JitCache *jit, bool writable)
+{
+    return mprotect(jit->code_buf, JIT_CODE_SIZE,
+                    writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC);
+}
+
+/** Translate the basic block of nb_instr instructions starting at pc, the
+ * block is left untranslated if the code buffer cannot be mapped.
+ */
+static void translate(struct Simulator *sim, uint32_t pc, uint32_t nb_instr)
+{
+    struct JitCache *jit = sim->jit;
+    if (jit->code_buf == NULL) {
+        void *buf = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf == MAP_FAILED) {
+            return;
+        }
+        jit->code_buf = buf;
+        emit_stubs(jit);
+    } else if (set_writable(jit, true) < 0) {
+        return;
+    }
+    if (jit->code_used + nb_instr * JIT_INSTR_BYTES + JIT_BLOCK_BYTES > JIT_CODE_SIZE) {
+        jit_flush(sim);
+        lookup(sim, pc);
+    }
+
+    struct Translation t = {.jit = jit, .pc = pc, .nb_instr = nb_instr};
+    for (uint32_t i = 0; i < nb_instr; i++) {
+        t.instrs[i] = isa_decoded_at(sim, pc + 4 * i);
+        t.native[i] = native_supported(t.instrs[i]);
+    }
+
+    uint8_t *start = emit_ptr = jit->code_buf + jit->code_used;
+    emit8(0x49); emit8(0x81); emit8(0xfd); emit32(nb_instr); // cmp r13, imm32
+    emit8(0x73); emit8(0x07); // jae over the return
+    emit_return(&t);
+    emit8(0x49); emit8(0x81); emit8(0xed); emit32(nb_instr); // sub r13, imm32
+    emit8(0x48); emit8(0xb8); emit64((uintptr_t) &jit->entered); // mov rax, imm64
+    emit8(0xc7); emit8(0x00); emit32(pc); // mov dword [rax], imm32
+    emit_entry_counts(&t, 0, 1);
+    for (uint32_t i = 0; i < nb_instr; i++) {
+        if (t.native[i]) {
+            emit_native(&t, i);
+        } else {
+            emit_fallback(&t, i);
+        }
+    }
+    const struct DecodedInstr *last = t.instrs[nb_instr - 1];
+    if (!t.native[nb_instr - 1] && block_ends_with(last)) {
+        emit_return(&t); // PC is wherever the instruction went
+    } else if (!(last->op == INSTR_BL && condition_always(last->cond))) {
+        emit_exit(&t, pc + 4 * nb_instr);
+    }
+    jit->code_used = emit_ptr - jit->code_buf;
+    if (set_writable(jit, false) < 0) {
+        jit_flush(sim); // nothing in the buffer can run
+        return;
+    }
+    jit->blocks[(pc - MEM_TEXT_START) >> 2].code = start;
+}
+
+struct JitCache * jit_create()
+{
+    return calloc(1, sizeof(struct JitCache));
+}
+
+void jit_destroy(struct JitCache *jit)
+{
+    if (jit != NULL && jit->code_buf != NULL) {
+        munmap(jit->code_buf, JIT_CODE_SIZE);
+    }
+    free(jit);
+}
+
+uint64_t jit_run(struct Simulator *sim, uint64_t max_instr)
+{
+    struct JitCache *jit = sim->jit;
+    uint64_t nb_instr = 0;
+    jit->exit_site = NULL;
+    while (nb_instr < max_instr && !sim->cpu.halted) {
+        uint32_t pc = sim->cpu.regs[PC];
+        struct JitBlock *block = lookup(sim, pc);
+        if (block == NULL || block->nb_instr > max_instr - nb_instr) {
+            process_instruction(sim);
+            nb_instr++;
+            jit->exit_site = NULL;
+            continue;
+        }
+        if (block->code == NULL && ++block->heat >= JIT_THRESHOLD) {
+            translate(sim, pc, block->nb_instr);
+        }
+        if (block->code == NULL) {
+            nb_instr += isa_execute_block(sim, pc, block->nb_instr);
+            jit->exit_site = NULL;
+            continue;
+        }
+        if (jit->exit_site != NULL && set_writable(jit, true) == 0) {
+            patch(jit->exit_site, block->code); // next time the previous block jumps here
+            if (set_writable(jit, false) < 0) {
+                jit_flush(sim);
+                continue;
+            }
+        }
+        jit->exit_site = NULL;
+        jit->code_modified = 0;
+        jit->in_code = 1;
+        uint64_t budget = max_instr - nb_instr;
+        nb_instr += budget - jit->enter(sim, budget, block->code);
+        jit->in_code = 0;
+    }
+    isa_sync_flags(sim);
+    return nb_instr;
+}
+
+void jit_abandon(struct Simulator *sim)
+{
+    struct JitCache *jit = sim->jit;
+    if (!jit->in_code) {
+        return;
+    }
+    jit->in_code = 0;
+    const struct JitBlock *block = &jit->blocks[(jit->entered - MEM_TEXT_START) >> 2];
+    uint32_t first = (sim->cpu.regs[PC] - jit->entered) / 4 + 1;
+    for (uint32_t i = first; i < block->nb_instr; i++) {
+        const struct DecodedInstr *instr = isa_decoded_at(sim, jit->entered + 4 * i);
+        if (native_supported(instr) && condition_always(instr->cond)) {
+            sim->stats.executed[instr->op]--;
+        }
+    }
+}
+
+void jit_invalidate(struct Simulator *sim, uint32_t address)
+{
+    uint32_t offset = address - MEM_TEXT_START;
+    if (offset < MEM_TEXT_SIZE && sim->jit->covered[offset >> 2]) {
+        jit_flush(sim);
+        sim->jit->code_modified = 1;
+    }
+}
+
+void jit_flush(struct Simulator *sim)
+{
+    struct JitCache *jit = sim->jit;
+    memset(jit->blocks, 0, jit->used * sizeof(struct JitBlock));
+    memset(jit->covered, 0, jit->used);
+    jit->used = 0;
+    jit->code_used = jit->code_start;
+    jit->exit_site = NULL;
+}
+
+#else
+
+struct JitCache {
+    uint8_t unused;
+};
+
+struct JitCache * jit_create()
+{
+    return calloc(1, sizeof(struct JitCache));
+}
+
+void jit_destroy(struct JitCache *jit)
+{
+    free(jit);
+}
+
+uint64_t jit_run(struct Simulator *sim, uint64_t max_instr)
+{
+    return process_instructions(sim, max_instr);
+}
+
+void jit_abandon(struct Simulator *sim)
+{
+}
+
+void jit_invalidate(struct Simulator *sim, uint32_t address)
+{
+}
+
+void jit_flush(struct Simulator *sim)
+{
+}
+
+#endif
@@ -0,0 +1,477 @@
+#define _DEFAULT_SOURCE // for MAP_PRIVATE and fstat
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <elf.h>
+#include "loader.h"
+#include "checkpoint.h"
+#include "simulator.h"
+
+/** A file's contents, mapped if possible */
+struct FileData {
+    const uint8_t *data;
+    size_t size;
+    int mapped; ///> 1 if data must be unmapped, 0 if freed
+};
+
+/** Map or, for pipes and the like, read the whole file fname.
+ * \return 0 on success, -1 after printing an error
+ */
+static int file_open(struct FileData *file, const char *fname)
+{
+    int fd = open(fname, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "Error: Could not open file %s\n", fname);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    file->data = NULL;
+    file->size = 0;
+    file->mapped = 0;
+    if (S_ISREG(st.st_mode)) {
+        file->size = st.st_size;
+        if (file->size > 0) {
+            void *data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                file->data = data;
+                file->mapped = 1;
+            }
+        }
+    }
+    if (!file->mapped) {
+        size_t capacity = 0;
+        uint8_t *data = NULL;
+        ssize_t nb_read;
+        file->size = 0;
+        do {
+            if (file->size == capacity) {
+                capacity = capacity ? 2 * capacity : 1 << 16;
+                uint8_t *grown = realloc(data, capacity);
+                if (grown == NULL) {
+                    break;
+                }
+                data = grown;
+            }
+            nb_read = read(fd, data + file->size, capacity - file->size);
+            if (nb_read > 0) {
+                file->size += nb_read;
+            }
+        } while (nb_read > 0);
+        if (nb_read != 0) {
+            fprintf(stderr, "Error: Could not read file %s\n", fname);
+            free(data);
+            close(fd);
+            return -1;
+        }
+        file->data = data;
+    }
+    close(fd);
+    return 0;
+}
+
+static void file_close(struct FileData *file)
+{
+    if (file->mapped) {
+        munmap((void *) file->data, file->size);
+    } else {
+        free((void *) file->data);
+    }
+}
+
+/** 0x10 | value of each hex digit, 0 for every other character */
+static const uint8_t hex_digits[256] = {
+    ['0'] = 0x10, ['1'] = 0x11, ['2'] = 0x12, ['3'] = 0x13, ['4'] = 0x14,
+    ['5'] = 0x15, ['6'] = 0x16, ['7'] = 0x17, ['8'] = 0x18, ['9'] = 0x19,
+    ['a'] = 0x1a, ['b'] = 0x1b, ['c'] = 0x1c, ['d'] = 0x1d, ['e'] = 0x1e, ['f'] = 0x1f,
+    ['A'] = 0x1a, ['B'] = 0x1b, ['C'] = 0x1c, ['D'] = 0x1d, ['E'] = 0x1e, ['F'] = 0x1f,
+};
+
+/** Parse 8 hex digits without branching on them.
+ * \return false if one of them is not a hex digit
+ */
+static inline bool parse_8_digits(const uint8_t *digits, uint32_t *word)
+{
+    uint32_t value = 0;
+    uint8_t valid = 0x10;
+    for (int i = 0; i < 8; i++) {
+        uint8_t digit = hex_digits[digits[i]];
+        value = value << 4 | (digit & 0xf);
+        valid &= digit;
+    }
+    *word = value;
+    return valid != 0;
+}
+
+static inline bool is_blank(uint8_t c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+/** Parse a line in any of the accepted forms, see loader_load().
+ * \param empty set if the line only holds blanks
+ * \return false if the line is malformed
+ */
+static bool parse_line(const uint8_t *line, const uint8_t *eol, uint32_t *word, bool *empty)
+{
+    while (line < eol && is_blank(*line)) {
+        line++;
+    }
+    while (eol > line && is_blank(eol[-1])) {
+        eol--;
+    }
+    *empty = line == eol;
+    if (eol - line > 2 && line[0] == '0' && (line[1] == 'x' || line[1] == 'X')) {
+        line += 2;
+    }
+    if (eol - line < 1 || eol - line > 8) {
+        return *empty;
+    }
+    uint32_t value = 0;
+    for (; line < eol; line++) {
+        uint8_t digit = hex_digits[*line];
+        if (digit == 0) {
+            return false;
+        }
+        value = value << 4 | (digit & 0xf);
+    }
+    *word = value;
+    return true;
+}
+
+/** Reinitialize sim, once the program to load is known to be valid
+ * \return 0 on success, -2 after printing an error
+ */
+static int reinitialize(struct Simulator *sim)
+{
+    if (sim_initialize(sim) < 0) {
+        fprintf(stderr, "Error: Could not map guest memory\n");
+        return -2;
+    }
+    return 0;
+}
+
+/** Load the hex program in file, see loader_load() */
+static int load_hex(struct Simulator *sim, const char *fname, const struct FileData *file)
+{
+    // a word takes at least 2 bytes, digit and newline
+    size_t max_words = file->size / 2 + 1;
+    if (max_words > MEM_TEXT_SIZE / 4 + 1) {
+        max_words = MEM_TEXT_SIZE / 4 + 1;
+    }
+    uint8_t *words = malloc(max_words * 4);
+    if (words == NULL) {
+        fprintf(stderr, "Error: Out of memory loading %s\n", fname);
+        return -1;
+    }
+
+    const uint8_t *p = file->data;
+    const uint8_t *end = p + file->size;
+    uint32_t nb_words = 0;
+    int line_nb = 0;
+    int ret = 0;
+    while (p < end) {
+        line_nb++;
+        uint32_t word;
+        const uint8_t *next;
+        if (end - p >= 9 && p[8] == '\n' && parse_8_digits(p, &word)) {
+            // arm2hex writes nothing but 8 digit lines
+            next = p + 9;
+        } else {
+            const uint8_t *eol = memchr(p, '\n', end - p);
+            if (eol == NULL) {
+                eol = end;
+            }
+            next = eol + 1;
+            bool empty;
+            if (!parse_line(p, eol, &word, &empty)) {
+                fprintf(stderr, "Error: %s:%d: Malformed line, expected a hex word\n",
+                        fname, line_nb);
+                ret = -1;
+                break;
+            }
+            if (empty) {
+                p = next;
+                continue;
+            }
+        }
+        if (nb_words == MEM_TEXT_SIZE / 4) {
+            fprintf(stderr, "Error: %s:%d: Program does not fit in the %d bytes of the text region\n",
+                    fname, line_nb, MEM_TEXT_SIZE);
+            ret = -1;
+            break;
+        }
+        uint8_t *dest = words + 4 * nb_words++;
+        dest[0] = word >> 24;
+        dest[1] = word >> 16;
+        dest[2] = word >> 8;
+        dest[3] = word;
+        p = next;
+    }
+    if (ret == 0) {
+        ret = reinitialize(sim);
+    }
+    if (ret == 0 && nb_words > 0) {
+        sim_mem_write_bytes(sim, MEM_TEXT_START, words, 4 * nb_words);
+    }
+    free(words);
+    return ret;
+}
+
+static inline uint16_t read_16(const uint8_t *p)
+{
+    return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static inline uint32_t read_32(const uint8_t *p)
+{
+    return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/** The fields of a big-endian section header used by load_elf() */
+struct Section {
+    const char *name;
+    uint32_t type;
+    uint32_t flags;
+    uint32_t addr; ///> where it goes in guest memory
+    uint32_t offset;
+    uint32_t size;
+    uint32_t link;
+    uint32_t align;
+};
+
+/** True if the size bytes at offset lie inside file */
+static inline bool in_file(const struct FileData *file, uint32_t offset, uint32_t size)
+{
+    return offset <= file->size && size <= file->size - offset;
+}
+
+/** True if size bytes at address lie in one region of the memory map, like
+ * sim_mem_write_bytes() wants them
+ */
+static bool fits_memory(const struct Simulator *sim, uint32_t address, uint32_t size)
+{
+    for (int i = 0; i < NB_REGIONS; i++) {
+        const struct MemoryRegion *region = &sim->mem_region[i];
+        if (address - region->start < region->size) {
+            return size <= region->size - (address - region->start);
+        }
+    }
+    return false;
+}
+
+/** True if symtab and its string table lie in file, the strings terminated */
+static bool symbols_valid(const struct FileData *file, const struct Section *sections,
+                          uint32_t nb_sections, const struct Section *symtab)
+{
+    if (symtab->link >= nb_sections || !in_file(file, symtab->offset, symtab->size)) {
+        return false;
+    }
+    const struct Section *strtab = &sections[symtab->link];
+    return in_file(file, strtab->offset, strtab->size) && strtab->size > 0 &&
+           file->data[strtab->offset + strtab->size - 1] == '\0';
+}
+
+/** Keep the function, object and untyped symbols of symtab, by address.
+ * symtab must be valid, see symbols_valid().
+ * \return 0 on success, -1 if out of memory
+ */
+static int load_symbols(struct Simulator *sim, const struct FileData *file,
+                        const struct Section *sections, uint32_t nb_sections,
+                        const struct Section *symtab, bool relocatable)
+{
+    const struct Section *strtab = &sections[symtab->link];
+    uint32_t nb_entries = symtab->size / sizeof(Elf32_Sym);
+    sim_clear_symbols(sim);
+    sim->symbols = malloc(nb_entries * sizeof(struct Symbol) + 1);
+    sim->symbol_names = malloc(strtab->size);
+    if (sim->symbols == NULL || sim->symbol_names == NULL) {
+        sim_clear_symbols(sim);
+        return -1;
+    }
+    memcpy(sim->symbol_names, file->data + strtab->offset, strtab->size);
+    for (uint32_t i = 0; i < nb_entries; i++) {
+        const uint8_t *entry = file->data + symtab->offset + i * sizeof(Elf32_Sym);
+        uint32_t name = read_32(entry);
+        uint32_t value = read_32(entry + 4);
+        uint32_t size = read_32(entry + 8);
+        uint8_t type = ELF32_ST_TYPE(entry[12]);
+        uint16_t shndx = read_16(entry + 14);
+        // $a, $d and the like only mark code and data inside functions
+        if (name == 0 || name >= strtab->size || sim->symbol_names[name] == '$' ||
+            (type != STT_FUNC && type != STT_OBJECT && type != STT_NOTYPE) ||
+            shndx == SHN_UNDEF || (shndx >= nb_sections && shndx != SHN_ABS)) {
+            continue;
+        }
+        if (relocatable && shndx != SHN_ABS) {
+            value += sections[shndx].addr;
+        }
+        struct Symbol *symbol = &sim->symbols[sim->nb_symbols++];
+        symbol->address = value;
+        symbol->size = size;
+        symbol->name = sim->symbol_names + name;
+    }
+    // insertion sort, symbol tables mostly come sorted already
+    for (uint32_t i = 1; i < sim->nb_symbols; i++) {
+        struct Symbol symbol = sim->symbols[i];
+        uint32_t j = i;
+        for (; j > 0 && sim->symbols[j - 1].address > symbol.address; j--) {
+            sim->symbols[j] = sim->symbols[j - 1];
+        }
+        sim->symbols[j] = symbol;
+    }
+    return 0;
+}
+
+/** Find the address of symbol name.
+ * \return false if there is no such symbol
+ */
+static bool symbol_address(const struct Simulator *sim, const char *name, uint32_t *address)
+{
+    for (uint32_t i = 0; i < sim->nb_symbols; i++) {
+        if (strcmp(sim->symbols[i].name, name) == 0) {
+            *address = sim->symbols[i].address;
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Load the ELF program in file, see loader_load() */
+static int load_elf(struct Simulator *sim, const char *fname, const struct FileData *file)
+{
+    const uint8_t *header = file->data;
+    if (file->size < sizeof(Elf32_Ehdr) || header[EI_CLASS] != ELFCLASS32 ||
+        header[EI_DATA] != ELFDATA2MSB || read_16(header + 18) != EM_ARM) {
+        fprintf(stderr, "Error: %s is not a big-endian 32-bit ARM ELF file\n", fname);
+        return -1;
+    }
+    uint16_t type = read_16(header + 16);
+    if (type != ET_EXEC && type != ET_REL) {
+        fprintf(stderr, "Error: %s is neither executable nor relocatable\n", fname);
+        return -1;
+    }
+    bool relocatable = type == ET_REL;
+    uint32_t entry = read_32(header + 24);
+    uint32_t shoff = read_32(header + 32);
+    uint16_t shentsize = read_16(header + 46);
+    uint16_t nb_sections = read_16(header + 48);
+    uint16_t shstrndx = read_16(header + 50);
+    if (shentsize < sizeof(Elf32_Shdr) || shstrndx >= nb_sections ||
+        !in_file(file, shoff, (uint32_t) nb_sections * shentsize)) {
+        fprintf(stderr, "Error: %s: Malformed section headers\n", fname);
+        return -1;
+    }
+
+    struct Section *sections = calloc(nb_sections, sizeof(struct Section));
+    if (sections == NULL) {
+        fprintf(stderr, "Error: Out of memory loading %s\n", fname);
+        return -1;
+    }
+    for (uint32_t i = 0; i < nb_sections; i++) {
+        const uint8_t *entry = file->data + shoff + i * shentsize;
+        sections[i].type = read_32(entry + 4);
+        sections[i].flags = read_32(entry + 8);
+        sections[i].addr = read_32(entry + 12);
+        sections[i].offset = read_32(entry + 16);
+        sections[i].size = read_32(entry + 20);
+        sections[i].link = read_32(entry + 24);
+        sections[i].align = read_32(entry + 32);
+        sections[i].name = "";
+    }
+    const struct Section *shstrtab = &sections[shstrndx];
+    if (in_file(file, shstrtab->offset, shstrtab->size) && shstrtab->size > 0 &&
+        file->data[shstrtab->offset + shstrtab->size - 1] == '\0') {
+        for (uint32_t i = 0; i < nb_sections; i++) {
+            uint32_t name = read_32(file->data + shoff + i * shentsize);
+            if (name < shstrtab->size) {
+                sections[i].name = (const char *) file->data + shstrtab->offset + name;
+            }
+        }
+    }
+
+    int ret = 0;
+    uint32_t next_text = MEM_TEXT_START;
+    uint32_t next_data = MEM_DATA_START;
+    const struct Section *symtab = NULL;
+    for (uint32_t i = 0; i < nb_sections && ret == 0; i++) {
+        struct Section *section = &sections[i];
+        if (section->type == SHT_SYMTAB) {
+            symtab = section;
+        }
+        if (!(section->flags & SHF_ALLOC) || section->size == 0) {
+            continue;
+        }
+        if (relocatable) {
+            uint32_t *next = section->flags & SHF_EXECINSTR ? &next_text : &next_data;
+            uint32_t align = section->align > 1 ? section->align : 1;
+            section->addr = (*next + align - 1) / align * align;
+            *next = section->addr + section->size;
+        }
+        if (section->type != SHT_NOBITS && !in_file(file, section->offset, section->size)) {
+            fprintf(stderr, "Error: %s: Section %s lies past the end of the file\n",
+                    fname, section->name);
+            ret = -1;
+        } else if (!fits_memory(sim, section->addr, section->size)) {
+            fprintf(stderr, "Error: %s: Section %s at %08x does not fit in the memory map\n",
+                    fname, section->name, section->addr);
+            ret = -1;
+        }
+    }
+    if (ret == 0 && symtab != NULL && !symbols_valid(file, sections, nb_sections, symtab)) {
+        fprintf(stderr, "Error: %s: Malformed symbol table\n", fname);
+        ret = -1;
+    }
+
+    // the file checks out, nothing fails from here on but memory allocation
+    if (ret == 0) {
+        ret = reinitialize(sim);
+    }
+    for (uint32_t i = 0; i < nb_sections && ret == 0; i++) {
+        const struct Section *section = &sections[i];
+        // NOBITS sections are left to memory starting zeroed
+        if ((section->flags & SHF_ALLOC) && section->size != 0 && section->type != SHT_NOBITS) {
+            sim_mem_write_bytes(sim, section->addr, file->data + section->offset, section->size);
+        }
+    }
+    if (ret == 0 && symtab != NULL &&
+        load_symbols(sim, file, sections, nb_sections, symtab, relocatable) < 0) {
+        fprintf(stderr, "Error: Out of memory loading %s\n", fname);
+        ret = -2;
+    }
+    free(sections);
+    if (ret != 0) {
+        return ret;
+    }
+    if (relocatable && !symbol_address(sim, "_start", &entry)) {
+        entry = MEM_TEXT_START;
+    }
+    sim_set_reg(sim, PC, entry);
+    return 0;
+}
+
+int loader_load(struct Simulator *sim, const char *fname)
+{
+    struct FileData file;
+    if (file_open(&file, fname) < 0) {
+        return -1;
+    }
+    int ret;
+    if (file.size >= CHECKPOINT_MAGIC_SIZE &&
+        memcmp(file.data, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_SIZE) == 0) {
+        ret = checkpoint_resume(sim, fname);
+    } else if (file.size >= SELFMAG && memcmp(file.data, ELFMAG, SELFMAG) == 0) {
+        ret = load_elf(sim, fname, &file);
+    } else {
+        ret = load_hex(sim, fname, &file);
+    }
+    file_close(&file);
+    return ret;
+}
@@ -0,0 +1,62 @@
+#include <stdint.h>
+#include "observe.h"
+#include "isa.h"
+#include "trace.h"
+#include "profile.h"
+#include "cache.h"
+#include "pipeline.h"
+#include "bpred.h"
+#include "simulator.h"
+
+bool observe_enabled(const struct Simulator *sim)
+{
+    return sim->trace != NULL || sim->profiling || sim->caches != NULL ||
+           sim->pipeline != NULL || sim->bpred != NULL;
+}
+
+uint64_t observe_run(struct Simulator *sim, uint64_t max_instr)
+{
+    uint64_t nb_instr = 0;
+    isa_sync_flags(sim);
+    if (sim->trace != NULL) {
+        trace_sync(sim);
+    }
+    while (nb_instr < max_instr && !sim->cpu.halted) {
+        uint32_t pc = sim->cpu.regs[PC];
+        const struct DecodedInstr *instr = isa_decoded_at(sim, pc);
+        // instr goes stale if the instruction overwrites itself
+        uint32_t instruction = instr->instruction;
+        if (sim->profiling) {
+            profile_count(sim->profile, pc, instr);
+        }
+        if (sim->caches != NULL) {
+            cache_fetch(sim->caches, pc);
+        }
+        bool predicted = sim->bpred != NULL && instr->op == INSTR_BL;
+        bool mispredicted = predicted && bpred_branch(sim, pc, instr);
+        if (sim->pipeline != NULL) {
+            pipeline_issue(sim, instr, predicted, mispredicted);
+        }
+        sim->observing = 1;
+        isa_execute_decoded(sim, instr);
+        sim->observing = 0;
+        if (sim->trace != NULL) {
+            isa_sync_flags(sim);
+            trace_instruction(sim, pc, instruction);
+        }
+        nb_instr++;
+    }
+    isa_sync_flags(sim);
+    return nb_instr;
+}
+
+void observe_memory(const struct Simulator *sim, uint32_t address, uint8_t kind, uint32_t value)
+{
+    if (sim->trace != NULL) {
+        trace_memory(sim->trace, address, kind, value);
+    }
+    if (sim->caches != NULL) {
+        cache_data(sim->caches, address, kind & MEM_ACCESS_BYTE ? 1 : 4,
+                   kind & MEM_ACCESS_WRITE);
+    }
+}
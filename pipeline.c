@@ -0,0 +1,220 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "pipeline.h"
+#include "isa.h"
+#include "isa_helper.h"
+#include "simulator.h"
+
+/* Instructions issue in order, one per cycle, and every result is forwarded
+ * to the next instruction as soon as it is computed, so only these cost
+ * extra cycles:
+ *  - reading a register loaded by the previous instruction, whose value only
+ *    comes out of memory: load_use_penalty
+ *  - a multiply, holding execute for mul_latency cycles
+ *  - a taken branch or other write to PC, resolved in execute (in memory for
+ *    loads, one cycle later) after the next instructions were fetched:
+ *    branch_penalty. With a branch predictor, fetch follows its predictions
+ *    for B and BL, which then only cost branch_penalty when mispredicted.
+ * The interlock looks at registers only, as decode does in hardware, so
+ * instructions failing their condition stall the same. Filling the pipeline
+ * costs 4 cycles before the first instruction retires.
+ */
+#define PIPELINE_FILL 4
+
+struct Pipeline {
+    struct PipelineConfig config;
+    uint16_t loaded; ///> registers loaded by the previous instruction, bit n for rn
+    uint64_t nb_instr;
+    uint64_t load_use_stalls; ///> cycles
+    uint64_t mul_stalls; ///> cycles
+    uint64_t nb_flushes; ///> taken branches and other PC writes, or mispredictions
+    uint64_t branch_stalls; ///> cycles
+};
+
+void pipeline_default_config(struct PipelineConfig *config)
+{
+    config->branch_penalty = 2;
+    config->mul_latency = 3;
+    config->load_use_penalty = 1;
+}
+
+int pipeline_parse_option(struct PipelineConfig *config, const char *option)
+{
+    static const struct {
+        const char *prefix;
+        size_t offset;
+    } options[] = {
+        {"branch=", offsetof(struct PipelineConfig, branch_penalty)},
+        {"mul=", offsetof(struct PipelineConfig, mul_latency)},
+        {"loaduse=", offsetof(struct PipelineConfig, load_use_penalty)},
+    };
+    for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+        size_t length = strlen(options[i].prefix);
+        if (strncmp(option, options[i].prefix, length) == 0) {
+            char *end;
+            unsigned long cycles = strtoul(option + length, &end, 0);
+            if (end == option + length || *end != '\0' || cycles > 1000) {
+                break;
+            }
+            *(uint32_t *) ((char *) config + options[i].offset) = cycles;
+            // a multiply takes execute for at least its one cycle
+            if (config->mul_latency == 0) {
+                config->mul_latency = 1;
+            }
+            return 0;
+        }
+    }
+    fprintf(stderr, "Error: Bad pipeline option %s, options are branch=, mul= and loaduse=<cycles>\n",
+            option);
+    return -1;
+}
+
+int pipeline_start(struct Simulator *sim, const struct PipelineConfig *config)
+{
+    pipeline_stop(sim);
+    struct Pipeline *pipeline = calloc(1, sizeof(struct Pipeline));
+    if (pipeline == NULL) {
+        fprintf(stderr, "Error: Out of memory for the pipeline model\n");
+        return -1;
+    }
+    pipeline->config = *config;
+    sim->pipeline = pipeline;
+    return 0;
+}
+
+void pipeline_stop(struct Simulator *sim)
+{
+    free(sim->pipeline);
+    sim->pipeline = NULL;
+}
+
+/** Registers instr reads, bit n for rn, PC excluded as fetch supplies it */
+static uint16_t registers_read(const struct DecodedInstr *instr)
+{
+    uint16_t regs = 0;
+    switch (instr->op) {
+        case INSTR_MOV: case INSTR_MVN:
+            break;
+        case INSTR_LDR: case INSTR_LDRB:
+            regs = 1 << instr->rn;
+            if (instr->I) { // register offset
+                regs |= 1 << instr->rm;
+            }
+            return regs & ~(1 << PC);
+        case INSTR_STR: case INSTR_STRB:
+            regs = 1 << instr->rn | 1 << instr->rd;
+            if (instr->I) {
+                regs |= 1 << instr->rm;
+            }
+            return regs & ~(1 << PC);
+        case INSTR_MLA:
+            regs = 1 << instr->rn;
+            // fall through
+        case INSTR_MUL:
+            return (regs | 1 << instr->rm | 1 << instr->rs) & ~(1 << PC);
+        case INSTR_BL: case INSTR_SWI: case INSTR_UND:
+            return 0;
+        default:
+            regs = 1 << instr->rn;
+            break;
+    }
+    // data processing, with the shifter operand
+    if (!instr->I) {
+        regs |= 1 << instr->rm;
+        if (get_bit(instr->instruction, 4)) { // shift by register
+            regs |= 1 << instr->rs;
+        }
+    }
+    return regs & ~(1 << PC);
+}
+
+/** True if instr writes PC when it executes */
+static bool writes_pc(const struct DecodedInstr *instr)
+{
+    switch (instr->op) {
+        case INSTR_TST: case INSTR_TEQ: case INSTR_CMP: case INSTR_CMN:
+        case INSTR_STR: case INSTR_STRB: case INSTR_SWI: case INSTR_UND:
+            return false;
+        case INSTR_BL:
+            return true;
+        case INSTR_LDR: case INSTR_LDRB:
+            return instr->rd == PC;
+        case INSTR_MUL: case INSTR_MLA:
+            return false; // unpredictable with Rd = PC, the ISA leaves PC alone
+        default:
+            return instr->rd == PC;
+    }
+}
+
+void pipeline_issue(struct Simulator *sim, const struct DecodedInstr *instr, bool predicted,
+                    bool mispredicted)
+{
+    struct Pipeline *pipeline = sim->pipeline;
+    const struct PipelineConfig *config = &pipeline->config;
+    pipeline->nb_instr++;
+    if (pipeline->loaded & registers_read(instr)) {
+        pipeline->load_use_stalls += config->load_use_penalty;
+    }
+    pipeline->loaded = 0;
+    if (predicted) {
+        // fetch followed the predictor, only its mistakes flush
+        if (mispredicted) {
+            pipeline->nb_flushes++;
+            pipeline->branch_stalls += config->branch_penalty;
+        }
+        return;
+    }
+
+    bool passed = true;
+    if (!condition_always(instr->cond)) {
+        isa_sync_flags(sim);
+        passed = condition_check(&sim->cpu, instr->cond);
+    }
+    if (!passed) {
+        return;
+    }
+    if (instr->op == INSTR_LDR || instr->op == INSTR_LDRB) {
+        pipeline->loaded = 1 << instr->rd;
+    } else if (instr->op == INSTR_MUL || instr->op == INSTR_MLA) {
+        pipeline->mul_stalls += config->mul_latency - 1;
+    }
+    if (writes_pc(instr)) {
+        pipeline->nb_flushes++;
+        pipeline->branch_stalls += config->branch_penalty;
+        if (instr->op == INSTR_LDR || instr->op == INSTR_LDRB) {
+            pipeline->branch_stalls++;
+        }
+    }
+}
+
+void pipeline_reset_counts(struct Pipeline *pipeline)
+{
+    pipeline->loaded = 0;
+    pipeline->nb_instr = 0;
+    pipeline->load_use_stalls = 0;
+    pipeline->mul_stalls = 0;
+    pipeline->nb_flushes = 0;
+    pipeline->branch_stalls = 0;
+}
+
+void pipeline_print_stats(FILE *fp, const struct Pipeline *pipeline, uint64_t memory_stalls,
+                          enum StatsFormat format)
+{
+    uint64_t cycles = 0;
+    if (pipeline->nb_instr > 0) {
+        cycles = PIPELINE_FILL + pipeline->nb_instr + pipeline->load_use_stalls +
+                 pipeline->mul_stalls + pipeline->branch_stalls + memory_stalls;
+    }
+    stats_print_count(fp, format, "pipe_instructions", pipeline->nb_instr);
+    stats_print_count(fp, format, "pipe_load_use_stalls", pipeline->load_use_stalls);
+    stats_print_count(fp, format, "pipe_mul_stalls", pipeline->mul_stalls);
+    stats_print_count(fp, format, "pipe_flushes", pipeline->nb_flushes);
+    stats_print_count(fp, format, "pipe_branch_stalls", pipeline->branch_stalls);
+    stats_print_count(fp, format, "pipe_memory_stalls", memory_stalls);
+    stats_print_count(fp, format, "pipe_cycles", cycles);
+    stats_print_real(fp, format, "pipe_cpi",
+                     pipeline->nb_instr > 0 ? (double) cycles / pipeline->nb_instr : 0);
+}
@@ -0,0 +1,135 @@
+#define _GNU_SOURCE // for pthreads and sysconf
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "pool.h"
+
+/* Each worker owns the range [begin, end) of task indexes still to run. It
+ * takes tasks from the front; a worker out of tasks steals the back half of
+ * someone else's range. Tasks are never added, so a worker finding every
+ * range empty can stop: whatever is still in flight has an owner.
+ */
+struct Range {
+    pthread_mutex_t lock;
+    size_t begin;
+    size_t end;
+};
+
+struct Pool {
+    struct Range *ranges; ///> one per worker
+    int nb_workers;
+    PoolTask task;
+    void *arg;
+};
+
+struct Worker {
+    struct Pool *pool;
+    int id;
+};
+
+/** Take the next task of range.
+ * \return false if it is empty
+ */
+static bool take(struct Range *range, size_t *index)
+{
+    pthread_mutex_lock(&range->lock);
+    bool found = range->begin < range->end;
+    if (found) {
+        *index = range->begin++;
+    }
+    pthread_mutex_unlock(&range->lock);
+    return found;
+}
+
+/** Move the back half of a victim's range into the empty range of worker id.
+ * \return false if every other range is empty
+ */
+static bool steal(struct Pool *pool, int id)
+{
+    for (int i = 1; i < pool->nb_workers; i++) {
+        struct Range *victim = &pool->ranges[(id + i) % pool->nb_workers];
+        pthread_mutex_lock(&victim->lock);
+        if (victim->begin >= victim->end) {
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        // the victim keeps the task it would take next
+        size_t mid = victim->begin + (victim->end - victim->begin + 1) / 2;
+        size_t end = victim->end;
+        victim->end = mid;
+        pthread_mutex_unlock(&victim->lock);
+        if (mid == end) {
+            continue;
+        }
+        struct Range *own = &pool->ranges[id];
+        pthread_mutex_lock(&own->lock);
+        own->begin = mid;
+        own->end = end;
+        pthread_mutex_unlock(&own->lock);
+        return true;
+    }
+    return false;
+}
+
+static void * work(void *arg)
+{
+    struct Worker *worker = arg;
+    struct Pool *pool = worker->pool;
+    size_t index;
+    do {
+        while (take(&pool->ranges[worker->id], &index)) {
+            pool->task(pool->arg, index, worker->id);
+        }
+    } while (steal(pool, worker->id));
+    return NULL;
+}
+
+int pool_run(int nb_workers, size_t nb_tasks, PoolTask task, void *arg)
+{
+    if (nb_workers < 1) {
+        nb_workers = 1;
+    }
+    struct Pool pool = {NULL, nb_workers, task, arg};
+    pool.ranges = calloc(nb_workers, sizeof(struct Range));
+    struct Worker *workers = calloc(nb_workers, sizeof(struct Worker));
+    pthread_t *threads = calloc(nb_workers, sizeof(pthread_t));
+    int ret = -1;
+    if (pool.ranges == NULL || workers == NULL || threads == NULL) {
+        goto out;
+    }
+    for (int i = 0; i < nb_workers; i++) {
+        pthread_mutex_init(&pool.ranges[i].lock, NULL);
+        pool.ranges[i].begin = nb_tasks * i / nb_workers;
+        pool.ranges[i].end = nb_tasks * (i + 1) / nb_workers;
+        workers[i].pool = &pool;
+        workers[i].id = i;
+    }
+    // the caller is worker 0
+    int started = 1;
+    for (; started < nb_workers; started++) {
+        if (pthread_create(&threads[started], NULL, work, &workers[started]) != 0) {
+            break;
+        }
+    }
+    work(&workers[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    // ranges of workers which could not be started were stolen by the others
+    ret = 0;
+    for (int i = 0; i < nb_workers; i++) {
+        pthread_mutex_destroy(&pool.ranges[i].lock);
+    }
+out:
+    free(threads);
+    free(workers);
+    free(pool.ranges);
+    return ret;
+}
+
+int pool_nb_cores()
+{
+    long nb = sysconf(_SC_NPROCESSORS_ONLN);
+    return nb < 1 ? 1 : (int) nb;
+}
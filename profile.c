@@ -0,0 +1,172 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "profile.h"
+#include "block.h"
+#include "isa.h"
+#include "simulator.h"
+
+#define PROFILE_SLOTS (MEM_TEXT_SIZE / 4)
+
+/** Execution counts of the text region, indexed by (PC - MEM_TEXT_START) / 4.
+ * A basic block starts wherever execution arrives other than by falling
+ * through from an instruction which does not end a block (see
+ * block_ends_with()), leaders marks these addresses.
+ */
+struct Profile {
+    uint64_t total; ///> instructions counted, in the text region or not
+    uint64_t outside; ///> instructions counted outside the text region
+    uint32_t next_pc; ///> PC falling through from the last instruction leads to
+    bool block_end; ///> 1 if the last instruction ended a basic block
+    uint64_t counts[PROFILE_SLOTS];
+    uint8_t leaders[PROFILE_SLOTS];
+};
+
+/** An instruction or a basic block of the report */
+struct HotSpot {
+    uint32_t address;
+    uint32_t nb_instr; ///> length of a basic block
+    uint64_t count; ///> instructions executed
+    uint64_t entries; ///> times a basic block was entered, i.e. its first instruction ran
+};
+
+int profile_start(struct Simulator *sim)
+{
+    if (sim->profile == NULL) {
+        sim->profile = malloc(sizeof(struct Profile));
+        if (sim->profile == NULL) {
+            fprintf(stderr, "Error: Out of memory starting profile\n");
+            return -1;
+        }
+    }
+    struct Profile *profile = sim->profile;
+    memset(profile, 0, sizeof(struct Profile));
+    profile->block_end = true;
+    sim->profiling = 1;
+    return 0;
+}
+
+void profile_stop(struct Simulator *sim)
+{
+    sim->profiling = 0;
+}
+
+void profile_destroy(struct Simulator *sim)
+{
+    free(sim->profile);
+    sim->profile = NULL;
+    sim->profiling = 0;
+}
+
+void profile_count(struct Profile *profile, uint32_t pc, const struct DecodedInstr *instr)
+{
+    uint32_t slot = (pc - MEM_TEXT_START) / 4;
+    profile->total++;
+    if (slot >= PROFILE_SLOTS) {
+        profile->outside++;
+        profile->block_end = true;
+        return;
+    }
+    profile->counts[slot]++;
+    if (profile->block_end || pc != profile->next_pc) {
+        profile->leaders[slot] = 1;
+    }
+    profile->next_pc = pc + 4;
+    profile->block_end = block_ends_with(instr);
+}
+
+/** Insert spot into top, the nb_top hottest spots so far by decreasing count.
+ * Ties keep the lower address first, as spots come by increasing address.
+ */
+static void keep_top(struct HotSpot *top, uint32_t nb_top, uint32_t *nb_kept,
+                     const struct HotSpot *spot)
+{
+    if (*nb_kept == nb_top && top[nb_top - 1].count >= spot->count) {
+        return;
+    }
+    uint32_t i = *nb_kept < nb_top ? (*nb_kept)++ : nb_top - 1;
+    for (; i > 0 && top[i - 1].count < spot->count; i--) {
+        top[i] = top[i - 1];
+    }
+    top[i] = *spot;
+}
+
+/** Print address along with the symbol containing it, if any */
+static void print_location(FILE *fp, const struct Simulator *sim, uint32_t address)
+{
+    uint32_t offset;
+    const char *name = sim_symbol_at(sim, address, &offset);
+    fprintf(fp, "%08x", address);
+    if (name != NULL) {
+        fprintf(fp, " <%s+0x%x>", name, offset);
+    }
+}
+
+int profile_report(struct Simulator *sim, FILE *fp, uint32_t nb_top)
+{
+    const struct Profile *profile = sim->profile;
+    if (profile == NULL) {
+        return -1;
+    }
+    if (nb_top == 0) {
+        return 0;
+    }
+    struct HotSpot *top_pcs = malloc(2 * nb_top * sizeof(struct HotSpot));
+    if (top_pcs == NULL) {
+        fprintf(stderr, "Error: Out of memory for the profile report\n");
+        return 0;
+    }
+    struct HotSpot *top_blocks = top_pcs + nb_top;
+    uint32_t nb_pcs = 0, nb_blocks = 0;
+
+    // one pass over the counts ranks instructions and rebuilds blocks: a block
+    // runs from a leader up to the next leader or unexecuted instruction
+    struct HotSpot block = {0};
+    for (uint32_t slot = 0; slot <= PROFILE_SLOTS; slot++) {
+        bool executed = slot < PROFILE_SLOTS && profile->counts[slot] > 0;
+        bool leader = slot < PROFILE_SLOTS && profile->leaders[slot];
+        if (block.nb_instr > 0 && (!executed || leader)) {
+            keep_top(top_blocks, nb_top, &nb_blocks, &block);
+            block.nb_instr = 0;
+        }
+        if (!executed) {
+            continue;
+        }
+        struct HotSpot spot = {MEM_TEXT_START + slot * 4, 1, profile->counts[slot],
+                               profile->counts[slot]};
+        keep_top(top_pcs, nb_top, &nb_pcs, &spot);
+        if (block.nb_instr == 0) {
+            block = spot;
+            block.nb_instr = 0;
+            block.count = 0;
+        }
+        block.nb_instr++;
+        block.count += spot.count;
+    }
+
+    double total = profile->total > 0 ? (double) profile->total : 1;
+    fprintf(fp, "%llu instructions profiled", (unsigned long long) profile->total);
+    if (profile->outside > 0) {
+        fprintf(fp, ", %llu outside the text region", (unsigned long long) profile->outside);
+    }
+    fprintf(fp, "\nTop instructions:\n");
+    fprintf(fp, "      count      %%  word      address\n");
+    for (uint32_t i = 0; i < nb_pcs; i++) {
+        fprintf(fp, "%11llu %6.2f  %08x  ", (unsigned long long) top_pcs[i].count,
+                100 * top_pcs[i].count / total, sim_mem_read_32(sim, top_pcs[i].address));
+        print_location(fp, sim, top_pcs[i].address);
+        fputc('\n', fp);
+    }
+    fprintf(fp, "Top basic blocks:\n");
+    fprintf(fp, "      count      %%    entries  length  address\n");
+    for (uint32_t i = 0; i < nb_blocks; i++) {
+        fprintf(fp, "%11llu %6.2f %10llu %7u  ", (unsigned long long) top_blocks[i].count,
+                100 * top_blocks[i].count / total, (unsigned long long) top_blocks[i].entries,
+                top_blocks[i].nb_instr);
+        print_location(fp, sim, top_blocks[i].address);
+        fputc('\n', fp);
+    }
+    free(top_pcs);
+    return 0;
+}
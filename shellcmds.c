@@ -1,47 +1,100 @@
 #include "shellcmds.h"
 #include "sim.h"
+#include "checkpoint.h"
+#include "dump.h"
+#include "trace.h"
+#include "profile.h"
+#include "stats.h"
+#include "cache.h"
+#include "pipeline.h"
+#include "bpred.h"
+#include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
 
 static int initialized = 0;
 #define CHECK_INIT if (!initialized) { printf("No program loaded\n"); return; }
 
-void cmd_run()
+#define MAX_SNAPSHOTS 16
+static struct Snapshot *snapshots[MAX_SNAPSHOTS]; ///> indexed by snapshot id
+static int tracing = 0;
+
+/** If the CPU stopped on a guest fault, report it along with a rdump.
+ * \return 1 if it did
+ */
+static int report_fault()
+{
+    struct CPUState state = get_cpu_state();
+    if (!state.faulted) {
+        return 0;
+    }
+    printf("CPU Fault: access to %08x outside the memory map at PC %08x\n",
+           state.fault_address, state.regs[PC]);
+    cmd_rdump(NULL);
+    return 1;
+}
+
+void dump_registers(FILE *fp, const struct CPUState *state)
+{
+    fprintf(fp, "HALTED: %s\n", state->halted ? "Yes" : "No");
+    for (int i = 0; i <= 14; i++) {
+        fprintf(fp, "   r%02d: %08x\n", i, state->regs[i]);
+    }
+    fprintf(fp, "    PC: %08x\n", state->regs[15]);
+    fprintf(fp, "  CPSR: %08x\n", state->CPSR);
+    fprintf(fp, "  (N: %d, Z: %d, C: %d, V: %d)\n",
+                 (state->CPSR >> CPSR_N) & 1,
+                 (state->CPSR >> CPSR_Z) & 1,
+                 (state->CPSR >> CPSR_C) & 1,
+                 (state->CPSR >> CPSR_V) & 1);
+}
+
+void cmd_run(enum RunEngine engine)
 {
     CHECK_INIT;
-    int cnt = 0;
-    while (cpu_cycle() >= 0) {
-        cnt++;
+    uint64_t nb_instr;
+    switch (engine) {
+        case RUN_BLOCKS: nb_instr = cpu_run_blocks(UINT64_MAX); break;
+        case RUN_JIT: nb_instr = cpu_run_jit(UINT64_MAX); break;
+        default: nb_instr = cpu_run(UINT64_MAX); break;
     }
-    printf("CPU Halted at %dth instruction\n", cnt);
+    if (report_fault()) {
+        return;
+    }
+    // the instruction which halts the CPU is not counted
+    uint64_t cnt = nb_instr > 0 ? nb_instr - 1 : 0;
+    printf("CPU Halted at %lluth instruction\n", (unsigned long long) cnt);
 }
 
 void cmd_file(char *fname)
 {
-    FILE *fp = fopen(fname, "r");
-    if (fp == NULL) {
-        fprintf(stderr, "Error: Could not open file %s\n", fname);
+    int ret = load_program(fname);
+    if (ret < 0) {
+        if (ret == -2) { // the program loaded before is gone
+            initialized = 0;
+        }
         return;
     }
-    initialize();
-    load_program(fp);
     initialized = 1;
     printf("Loaded file %s into memory\n", fname);
-    fclose(fp);
 }
 
 void cmd_step(int nbstep) {
     CHECK_INIT;
-    for (int i = 0; i < nbstep; i++) {
-        if (cpu_cycle() < 0) {
-            printf("CPU Halted @ %dth step\n", i+1);
+    // one run of nbstep instructions, rather than nbstep runs of one
+    uint64_t nb_instr = cpu_run(nbstep);
+    if (get_cpu_state().halted) {
+        if (report_fault()) {
             return;
         }
+        // a CPU halted beforehand stops at the first step
+        printf("CPU Halted @ %lluth step\n", (unsigned long long) (nb_instr ? nb_instr : 1));
+        return;
     }
     printf("Successfully executed %d instructions\n", nbstep);
 }
 
-void cmd_mdump(uint32_t low_addr, uint32_t high_addr, char *fname)
+void cmd_mdump(uint32_t low_addr, uint32_t high_addr, char *fname, enum DumpMode mode)
 {
     CHECK_INIT;
     FILE *fp;
@@ -54,10 +107,12 @@ void cmd_mdump(uint32_t low_addr, uint32_t high_addr, char *fname)
             return;
         }
     }
-    uint32_t word;
-    for (uint32_t addr = low_addr; addr <= high_addr; addr += 4) {
-        word = mem_read_32(addr);
-        fprintf(fp, "%08x: %08x\n", addr, word);
+    uint32_t bad_addr;
+    int ret = dump_memory(fp, sim_default(), low_addr, high_addr, mode, &bad_addr);
+    if (ret == -1) {
+        fprintf(stderr, "Error: %08x is outside the memory map\n", bad_addr);
+    } else if (ret < 0) {
+        fprintf(stderr, "Error: Could not write memory dump\n");
     }
     if (fp != stdout) {
         fclose(fp);
@@ -78,22 +133,208 @@ void cmd_rdump(char *fname)
         }
     }
     struct CPUState state = get_cpu_state();
-    fprintf(fp, "HALTED: %s\n", state.halted ? "Yes" : "No");
-    for (int i = 0; i <= 14; i++) {
-        fprintf(fp, "   r%02d: %08x\n", i, state.regs[i]);
-    }
-    fprintf(fp, "    PC: %08x\n", state.regs[15]);
-    fprintf(fp, "  CPSR: %08x\n", state.CPSR);
-    fprintf(fp, "  (N: %d, Z: %d, C: %d, V: %d)\n",
-                 (state.CPSR >> CPSR_N) & 1,
-                 (state.CPSR >> CPSR_Z) & 1,
-                 (state.CPSR >> CPSR_C) & 1,
-                 (state.CPSR >> CPSR_V) & 1);
+    dump_registers(fp, &state);
     if (fp != stdout) {
         fclose(fp);
     }
 }
 
+void cmd_snapshot()
+{
+    CHECK_INIT;
+    int id = 0;
+    while (id < MAX_SNAPSHOTS && snapshots[id] != NULL) {
+        id++;
+    }
+    if (id == MAX_SNAPSHOTS) {
+        fprintf(stderr, "Error: Too many snapshots, at most %d\n", MAX_SNAPSHOTS);
+        return;
+    }
+    snapshots[id] = snapshot_take();
+    if (snapshots[id] == NULL) {
+        fprintf(stderr, "Error: Could not take snapshot\n");
+        return;
+    }
+    printf("Snapshot %d taken\n", id);
+}
+
+void cmd_restore(int id)
+{
+    if (id < 0 || id >= MAX_SNAPSHOTS || snapshots[id] == NULL) {
+        fprintf(stderr, "Error: No snapshot %d\n", id);
+        return;
+    }
+    if (snapshot_restore(snapshots[id]) < 0) {
+        fprintf(stderr, "Error: Could not restore snapshot %d\n", id);
+        return;
+    }
+    initialized = 1;
+    printf("Restored snapshot %d\n", id);
+}
+
+void cmd_checkpoint(char *fname, bool compress)
+{
+    CHECK_INIT;
+    if (checkpoint_save(sim_default(), fname, compress) == 0) {
+        printf("Saved checkpoint %s\n", fname);
+    }
+}
+
+void cmd_resume(char *fname)
+{
+    int ret = checkpoint_resume(sim_default(), fname);
+    if (ret < 0) {
+        if (ret == -2) { // the program loaded before is gone
+            initialized = 0;
+        }
+        return;
+    }
+    initialized = 1;
+    printf("Resumed checkpoint %s\n", fname);
+}
+
+/** Stop the trace, printing how many instructions it holds */
+static void stop_trace()
+{
+    uint64_t nb_instr;
+    tracing = 0;
+    if (trace_stop(sim_default(), &nb_instr) < 0) {
+        fprintf(stderr, "Error: Could not write the whole trace\n");
+        return;
+    }
+    printf("Traced %llu instructions\n", (unsigned long long) nb_instr);
+}
+
+/** Make sure the trace is complete on disk when the shell quits */
+static void stop_trace_at_exit()
+{
+    if (tracing) {
+        stop_trace();
+    }
+}
+
+void cmd_trace(char *fname)
+{
+    static int registered = 0;
+    if (fname == NULL) {
+        if (!tracing) {
+            fprintf(stderr, "Error: Not tracing\n");
+            return;
+        }
+        stop_trace();
+        return;
+    }
+    if (trace_start(sim_default(), fname) < 0) {
+        return;
+    }
+    tracing = 1;
+    if (!registered) {
+        atexit(stop_trace_at_exit);
+        registered = 1;
+    }
+    printf("Tracing to %s\n", fname);
+}
+
+void cmd_profile(bool on)
+{
+    if (!on) {
+        profile_stop(sim_default());
+        return;
+    }
+    if (profile_start(sim_default()) == 0) {
+        printf("Profiling\n");
+    }
+}
+
+void cmd_profile_report(uint32_t nb_top)
+{
+    if (profile_report(sim_default(), stdout, nb_top) < 0) {
+        fprintf(stderr, "Error: No profile, run `profile on` first\n");
+    }
+}
+
+void cmd_cache(bool on, char **options, int nb_options)
+{
+    if (!on) {
+        cache_stop(sim_default());
+        return;
+    }
+    struct CacheModelConfig config;
+    cache_default_config(&config);
+    for (int i = 0; i < nb_options; i++) {
+        if (cache_parse_option(&config, options[i]) < 0) {
+            return;
+        }
+    }
+    if (cache_start(sim_default(), &config) == 0) {
+        printf("Modeling caches\n");
+    }
+}
+
+void cmd_pipeline(bool on, char **options, int nb_options)
+{
+    if (!on) {
+        pipeline_stop(sim_default());
+        return;
+    }
+    struct PipelineConfig config;
+    pipeline_default_config(&config);
+    for (int i = 0; i < nb_options; i++) {
+        if (pipeline_parse_option(&config, options[i]) < 0) {
+            return;
+        }
+    }
+    if (pipeline_start(sim_default(), &config) == 0) {
+        printf("Modeling the pipeline\n");
+    }
+}
+
+void cmd_bpred(bool on, char **options, int nb_options)
+{
+    if (!on) {
+        bpred_stop(sim_default());
+        return;
+    }
+    struct BranchPredictorConfig config;
+    bpred_default_config(&config);
+    for (int i = 0; i < nb_options; i++) {
+        if (bpred_parse_option(&config, options[i]) < 0) {
+            return;
+        }
+    }
+    if (bpred_start(sim_default(), &config) == 0) {
+        printf("Predicting branches\n");
+    }
+}
+
+void cmd_bpred_report(uint32_t nb_top)
+{
+    if (bpred_report(sim_default(), stdout, nb_top) < 0) {
+        fprintf(stderr, "Error: No branch predictor, run `bpred on` first\n");
+    }
+}
+
+void cmd_stats(char *fname, enum StatsFormat format)
+{
+    FILE *fp = stdout;
+    if (fname != NULL) {
+        fp = fopen(fname, "w");
+        if (fp == NULL) {
+            fprintf(stderr, "Error: Could not open file %s\n", fname);
+            return;
+        }
+    }
+    stats_print(fp, sim_default(), format);
+    if (fname != NULL) {
+        fclose(fp);
+    }
+}
+
+void cmd_stats_reset()
+{
+    stats_reset(sim_default());
+}
+
 void cmd_set(int reg_num, uint32_t reg_val)
 {
     CHECK_INIT;
@@ -102,12 +343,25 @@ void cmd_set(int reg_num, uint32_t reg_val)
 
 void cmd_help()
 {
-    printf("`r` or `run`: simulate the program until it indicates that the simulator should halt.\n");
+    printf("`r` or `run [--blocks|--jit]`: simulate the program until it indicates that the simulator should halt, optionally a basic block at a time or translating hot code to native code.\n");
     printf("`file <hexfile>`: load this file in program memory.\n");
     printf("`step [i]`: execute one instruction (or optionally `i`)\n");
-    printf("`mdump 0x<low> 0x<high> [dumpfile]`: dump the contents of memory, from location low to location high to the screen or to the dump file [dumpfile].\n");
+    printf("`mdump 0x<low> 0x<high> [dumpfile] [--nonzero|--binary]`: dump the contents of memory, from location low to location high to the screen or to the dump file [dumpfile], optionally only the non-zero words or the raw bytes.\n");
     printf("`rdump [dumpfile]`: dump the current instruction count, the contents of R0 – R14, R15 (PC), and the CPSR to the screen or to the file [dumpfile].\n");
     printf("`set r<n> 0x<reg_val>`: set general purpose register reg r_n to value reg_val.\n");
+    printf("`snapshot`: save registers and memory, printing the id of the snapshot.\n");
+    printf("`restore <id>`: bring registers and memory back to snapshot id, which can be restored again later.\n");
+    printf("`checkpoint <file> [--compress]`: save registers and memory to file, optionally compressed.\n");
+    printf("`resume <file>`: bring registers and memory back to the checkpoint in file.\n");
+    printf("`trace on <file>` / `trace off`: record every instruction executed, with the registers and memory it changed, to a compressed binary file, which `armsh-trace <file>` prints. Runs are interpreted while tracing.\n");
+    printf("`profile on` / `profile off`: count the instructions executed at each address. Runs are interpreted while profiling.\n");
+    printf("`profile report [n]`: print the n (default 10) most executed instructions and basic blocks with their share of all instructions profiled.\n");
+    printf("`cache on [l1i=|l1d=|l2=<size>:<ways>:<line>[:lru|fifo|random]] [l2=off] [l2lat=<cycles>] [mem=<cycles>]` / `cache off`: model L1 instruction and data caches and a unified L2, reported by `stats`. Runs are interpreted while modeling caches.\n");
+    printf("`pipeline on [branch=<cycles>] [mul=<cycles>] [loaduse=<cycles>]` / `pipeline off`: model the timing of a 5-stage in-order pipeline, reported by `stats` as cycles and CPI. Runs are interpreted while modeling the pipeline.\n");
+    printf("`bpred on [not-taken|bimodal|gshare|btb] [entries=<n>] [history=<bits>]` / `bpred off`: predict B and BL with the given model, reported by `stats`. Runs are interpreted while predicting branches.\n");
+    printf("`bpred report [n]`: print the n (default 10) branches mispredicted the most, with their misprediction rates.\n");
+    printf("`stats [statsfile] [--csv]`: print the instruction mix, condition-failed instructions, loads and stores by width, taken and not-taken branches and simulated MIPS since the program was loaded, to the screen or to statsfile, optionally as name,value lines.\n");
+    printf("`stats reset`: zero the statistics.\n");
     printf("`?` or `help`: print out a list of all shell commands.\n");
     printf("`q` or `quit`: quit the shell.\n");
 }
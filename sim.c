@@ -1,113 +1,589 @@
+#define _GNU_SOURCE // for MAP_ANONYMOUS, MAP_NORESERVE, siginfo_t and memfd_create
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <assert.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <time.h>
 #include "sim.h"
 #include "isa.h"
+#include "jit.h"
+#include "block.h"
+#include "loader.h"
+#include "trace.h"
+#include "profile.h"
+#include "cache.h"
+#include "pipeline.h"
+#include "bpred.h"
+#include "observe.h"
+#include "stats.h"
+#include "simulator.h"
 
-static struct CPUState cpu_state;
+/* Each simulator reserves the whole 4 GiB guest address space as one
+ * PROT_NONE host mapping followed by a guard page, so guest address a lives
+ * at mem_base + a. Only the regions of mem_region[] are mapped, with
+ * MAP_NORESERVE so pages cost memory once touched. Accesses anywhere else hit
+ * an inaccessible page and the SIGSEGV handler turns them into a guest fault.
+ */
+#define MEM_GUARD_SIZE 4096 // catches words straddling the end of the space
 
-static struct MemoryRegion mem_region[NB_REGIONS] = {
+static const struct MemoryRegion regions[NB_REGIONS] = {
     {MEM_TEXT_START, MEM_TEXT_SIZE, NULL},
     {MEM_DATA_START, MEM_DATA_SIZE, NULL},
 };
 
-void initialize()
+/** Last text version handed out, shared so that versions of different
+ * simulators never match by accident.
+ */
+static uint64_t last_text_version;
+
+// a run belongs to one thread, so does recovering from its faults
+static __thread sigjmp_buf *fault_recovery; ///> where guest faults return to, NULL outside runs
+static __thread struct Simulator *running; ///> simulator of the current run
+static __thread uint32_t fault_address; ///> guest address of the last fault
+
+/** Simulator behind the global API, created on first use */
+static struct Simulator *default_sim;
+
+/** SIGSEGV/SIGBUS handler, faults of guest accesses during a run return to
+ * fault_recovery, anything else crashes as usual.
+ */
+static void on_fault(int sig, siginfo_t *info, void *context)
+{
+    uint8_t *addr = info->si_addr;
+    if (fault_recovery == NULL || addr < running->mem_base ||
+        addr >= running->mem_base + MEM_SPACE_SIZE + MEM_GUARD_SIZE) {
+        signal(sig, SIG_DFL); // the access is retried and crashes
+        return;
+    }
+    fault_address = addr - running->mem_base;
+    // runs do not save the signal mask, which costs a syscall each, so sig
+    // is unblocked here instead of by siglongjmp()
+    sigset_t unblock;
+    sigemptyset(&unblock);
+    sigaddset(&unblock, sig);
+    pthread_sigmask(SIG_UNBLOCK, &unblock, NULL);
+    siglongjmp(*fault_recovery, 1);
+}
+
+/** Install the fault handler, once per process */
+static void install_fault_handler()
+{
+    static int installed;
+    if (__atomic_exchange_n(&installed, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = on_fault;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, NULL);
+    sigaction(SIGBUS, &action, NULL);
+}
+
+static uint64_t next_text_version()
+{
+    return __atomic_add_fetch(&last_text_version, 1, __ATOMIC_RELAXED);
+}
+
+struct Simulator * sim_create()
+{
+    struct Simulator *sim = calloc(1, sizeof(struct Simulator));
+    if (sim == NULL) {
+        return NULL;
+    }
+    void *base = mmap(NULL, MEM_SPACE_SIZE + MEM_GUARD_SIZE, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    sim->blocks = block_create();
+    sim->jit = jit_create();
+    if (base == MAP_FAILED || sim->blocks == NULL || sim->jit == NULL) {
+        if (base != MAP_FAILED) {
+            munmap(base, MEM_SPACE_SIZE + MEM_GUARD_SIZE);
+        }
+        block_destroy(sim->blocks);
+        jit_destroy(sim->jit);
+        free(sim);
+        return NULL;
+    }
+    sim->mem_base = base;
+    memcpy(sim->mem_region, regions, sizeof(regions));
+    install_fault_handler();
+    sim_reset_cpu(sim);
+    return sim;
+}
+
+void sim_destroy(struct Simulator *sim)
+{
+    if (sim == NULL) {
+        return;
+    }
+    if (sim->trace != NULL) {
+        uint64_t nb_instr;
+        trace_stop(sim, &nb_instr);
+    }
+    profile_destroy(sim);
+    cache_stop(sim);
+    pipeline_stop(sim);
+    bpred_stop(sim);
+    munmap(sim->mem_base, MEM_SPACE_SIZE + MEM_GUARD_SIZE);
+    sim_clear_symbols(sim);
+    block_destroy(sim->blocks);
+    jit_destroy(sim->jit);
+    free(sim);
+}
+
+int sim_initialize(struct Simulator *sim)
 {
     int i;
-    reset_cpu();
+    sim_reset_cpu(sim);
     for (i = 0; i < NB_REGIONS; i++) {
-        mem_region[i].mem = malloc(sizeof(uint8_t) * mem_region[i].size);
-        memset(mem_region[i].mem, 0, sizeof(uint8_t) * mem_region[i].size);
+        // mapping over the old pages drops them, so memory starts zeroed
+        void *mem = mmap(sim->mem_base + sim->mem_region[i].start, sim->mem_region[i].size,
+                         PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+        if (mem == MAP_FAILED) {
+            return -1;
+        }
+        sim->mem_region[i].mem = mem;
     }
+    memset(sim->written, 0, sizeof(sim->written));
+    sim_clear_symbols(sim);
+    stats_reset(sim);
+    if (sim->caches != NULL) {
+        cache_invalidate(sim->caches);
+    }
+    sim->text_version = next_text_version();
+    isa_flush_decode_cache(sim);
+    jit_flush(sim);
+    block_flush(sim);
+    return 0;
 }
 
-void reset_cpu()
+void sim_reset_cpu(struct Simulator *sim)
 {
     int i;
-    cpu_state.CPSR = 0x00;
+    sim->cpu.CPSR = 0x00;
     for (i = 0; i < NB_REGS; i++) {
-        cpu_state.regs[i] = 0x00;
+        sim->cpu.regs[i] = 0x00;
+    }
+    sim->cpu.regs[PC] = sim->mem_region[MEM_TEXT].start;
+    sim->cpu.halted = 0;
+    sim->cpu.faulted = 0;
+    sim->cpu.fault_address = 0;
+}
+
+/** Drop everything derived from the text word containing address */
+static void invalidate_text(struct Simulator *sim, uint32_t address)
+{
+    sim->text_version = next_text_version();
+    isa_invalidate(sim, address);
+    jit_invalidate(sim, address);
+    block_invalidate(sim, address);
+}
+
+bool sim_mem_mapped(const struct Simulator *sim, uint32_t address)
+{
+    for (int i = 0; i < NB_REGIONS; i++) {
+        if (address - sim->mem_region[i].start < sim->mem_region[i].size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** True if a write of size bytes to address touches the text region */
+static inline bool writes_text(uint32_t address, uint32_t size)
+{
+    return address - MEM_TEXT_START < MEM_TEXT_SIZE ||
+           address + size - 1 - MEM_TEXT_START < MEM_TEXT_SIZE;
+}
+
+/** Remember that the page containing address was written */
+static inline void mark_written(struct Simulator *sim, uint32_t address)
+{
+    uint32_t page = address >> MEM_PAGE_BITS;
+    sim->written[page / 8] |= 1 << (page % 8);
+}
+
+void sim_mem_write_8(struct Simulator *sim, uint32_t address, uint8_t data)
+{
+    sim->mem_base[address] = data;
+    mark_written(sim, address);
+    if (writes_text(address, 1)) {
+        invalidate_text(sim, address);
+    }
+    if (sim->observing) {
+        observe_memory(sim, address, MEM_ACCESS_WRITE | MEM_ACCESS_BYTE, data);
+    }
+}
+
+uint8_t sim_mem_read_8(const struct Simulator *sim, uint32_t address)
+{
+    uint8_t data = sim->mem_base[address];
+    if (sim->observing) {
+        observe_memory(sim, address, MEM_ACCESS_BYTE, data);
+    }
+    return data;
+}
+
+void sim_mem_write_32(struct Simulator *sim, uint32_t address, uint32_t data)
+{
+    uint8_t *host = sim->mem_base + address;
+    host[0] = (data >> 24) & 0xFF;
+    host[1] = (data >> 16) & 0xFF;
+    host[2] = (data >>  8) & 0xFF;
+    host[3] = (data >>  0) & 0xFF;
+    mark_written(sim, address);
+    mark_written(sim, address + 3);
+    if (writes_text(address, 4)) {
+        // unaligned writes may straddle two instruction words
+        invalidate_text(sim, address);
+        invalidate_text(sim, address + 3);
+    }
+    if (sim->observing) {
+        observe_memory(sim, address, MEM_ACCESS_WRITE, data);
+    }
+}
+
+uint32_t sim_mem_read_32(const struct Simulator *sim, uint32_t address)
+{
+    const uint8_t *host = sim->mem_base + address;
+    uint32_t data =
+        ((uint32_t) host[0] << 24) |
+        (host[1] << 16) |
+        (host[2] <<  8) |
+        (host[3] <<  0);
+    if (sim->observing) {
+        observe_memory(sim, address, 0, data);
+    }
+    return data;
+}
+
+int sim_mem_write_bytes(struct Simulator *sim, uint32_t address, const void *data,
+                        uint32_t size)
+{
+    const struct MemoryRegion *region = NULL;
+    for (int i = 0; i < NB_REGIONS; i++) {
+        if (address - sim->mem_region[i].start < sim->mem_region[i].size) {
+            region = &sim->mem_region[i];
+        }
+    }
+    if (size == 0) {
+        return 0;
+    }
+    if (region == NULL || size > region->size - (address - region->start)) {
+        return -1;
+    }
+    memcpy(sim->mem_base + address, data, size);
+    for (uint64_t page = address >> MEM_PAGE_BITS;
+         page <= (address + size - 1) >> MEM_PAGE_BITS; page++) {
+        sim->written[page / 8] |= 1 << (page % 8);
+    }
+    if (writes_text(address, size)) {
+        // cheaper than invalidating word by word
+        sim->text_version = next_text_version();
+        isa_flush_decode_cache(sim);
+        jit_flush(sim);
+        block_flush(sim);
+    }
+    return 0;
+}
+
+int sim_load_program(struct Simulator *sim, const char *fname)
+{
+    return loader_load(sim, fname);
+}
+
+void sim_clear_symbols(struct Simulator *sim)
+{
+    free(sim->symbols);
+    free(sim->symbol_names);
+    sim->symbols = NULL;
+    sim->symbol_names = NULL;
+    sim->nb_symbols = 0;
+}
+
+const char * sim_symbol_at(const struct Simulator *sim, uint32_t address, uint32_t *offset)
+{
+    // last symbol starting at or below address
+    uint32_t low = 0, high = sim->nb_symbols;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (sim->symbols[mid].address <= address) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low == 0) {
+        return NULL;
     }
-    cpu_state.regs[PC] = mem_region[MEM_TEXT].start;
-    cpu_state.halted = 0;
+    const struct Symbol *symbol = &sim->symbols[low - 1];
+    if (symbol->size != 0 && address - symbol->address >= symbol->size) {
+        return NULL;
+    }
+    *offset = address - symbol->address;
+    return symbol->name;
+}
+
+/** Host monotonic time in nanoseconds */
+static uint64_t now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/** Call run on sim, an access outside the memory map stops it with a
+ * guest fault instead of crashing the simulator.
+ * \return what run returned, 0 after a fault
+ */
+static uint64_t guarded_run(struct Simulator *sim,
+                            uint64_t (*run)(struct Simulator *, uint64_t),
+                            uint64_t max_cycles)
+{
+    sigjmp_buf recovery;
+    uint64_t start_ns = now_ns();
+    sim->stats.nb_runs++;
+    if (sigsetjmp(recovery, 0)) {
+        // the faulting instruction is abandoned, PC still points to it
+        fault_recovery = NULL;
+        running = NULL;
+        isa_sync_flags(sim);
+        jit_abandon(sim);
+        sim->observing = 0;
+        sim->cpu.halted = 1;
+        sim->cpu.faulted = 1;
+        sim->cpu.fault_address = fault_address;
+        sim->stats.run_ns += now_ns() - start_ns;
+        return 0;
+    }
+    running = sim;
+    fault_recovery = &recovery;
+    // every engine falls back to the interpreter while models watch
+    if (observe_enabled(sim)) {
+        run = observe_run;
+    }
+    uint64_t nb_instr = run(sim, max_cycles);
+    fault_recovery = NULL;
+    running = NULL;
+    sim->stats.run_ns += now_ns() - start_ns;
+    sim->stats.run_instr += nb_instr;
+    return nb_instr;
+}
+
+int sim_cpu_cycle(struct Simulator *sim)
+{
+    guarded_run(sim, process_instructions, 1);
+    return -sim->cpu.halted;
+}
+
+uint64_t sim_cpu_run(struct Simulator *sim, uint64_t max_cycles)
+{
+    return guarded_run(sim, process_instructions, max_cycles);
+}
+
+uint64_t sim_cpu_run_blocks(struct Simulator *sim, uint64_t max_cycles)
+{
+    return guarded_run(sim, block_run, max_cycles);
+}
+
+uint64_t sim_cpu_run_jit(struct Simulator *sim, uint64_t max_cycles)
+{
+    return guarded_run(sim, jit_run, max_cycles);
 }
 
-/** Find memory region of an address */
-static struct MemoryRegion * find_mem_region(uint32_t address) {
+/* A snapshot keeps the regions back to back in a memfd, in mem_region[]
+ * order, holding only the pages written so far. Restoring maps the memfd
+ * MAP_PRIVATE over the regions, so it costs no copy and any number of
+ * restores share the snapshot's pages until they write to them. Snapshots
+ * can be restored into any simulator.
+ */
+struct Snapshot {
+    struct CPUState cpu_state;
+    int fd;
+    uint64_t text_version;
+    uint8_t written[sizeof(((struct Simulator *) 0)->written)];
+};
+
+struct Snapshot * sim_snapshot_take(const struct Simulator *sim)
+{
+    struct Snapshot *snap = malloc(sizeof(struct Snapshot));
+    if (snap == NULL) {
+        return NULL;
+    }
+    snap->fd = memfd_create("armsim-snapshot", 0);
+    off_t size = 0;
     for (int i = 0; i < NB_REGIONS; i++) {
-        if (mem_region[i].start <= address &&
-            address < (mem_region[i].start + mem_region[i].size)) {
-            return &mem_region[i];
+        size += sim->mem_region[i].size;
+    }
+    if (snap->fd < 0 || ftruncate(snap->fd, size) < 0) {
+        goto fail;
+    }
+    off_t offset = 0;
+    for (int i = 0; i < NB_REGIONS; i++) {
+        const struct MemoryRegion *region = &sim->mem_region[i];
+        for (uint32_t page = 0; page < region->size; page += MEM_PAGE_SIZE) {
+            uint32_t id = (region->start + page) >> MEM_PAGE_BITS;
+            if ((sim->written[id / 8] >> (id % 8)) & 1 &&
+                pwrite(snap->fd, region->mem + page, MEM_PAGE_SIZE,
+                       offset + page) != MEM_PAGE_SIZE) {
+                goto fail;
+            }
         }
+        offset += region->size;
+    }
+    snap->cpu_state = sim->cpu;
+    snap->text_version = sim->text_version;
+    memcpy(snap->written, sim->written, sizeof(sim->written));
+    return snap;
+fail:
+    if (snap->fd >= 0) {
+        close(snap->fd);
     }
+    free(snap);
     return NULL;
 }
 
-void mem_write_8(uint32_t address, uint8_t data)
+int sim_snapshot_restore(struct Simulator *sim, const struct Snapshot *snap)
 {
-    struct MemoryRegion *region = find_mem_region(address);
-    assert(region != NULL);
-    uint32_t offset = address - region->start;
-    region->mem[offset] = data;
+    off_t offset = 0;
+    for (int i = 0; i < NB_REGIONS; i++) {
+        void *mem = mmap(sim->mem_base + sim->mem_region[i].start, sim->mem_region[i].size,
+                         PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_NORESERVE | MAP_FIXED, snap->fd, offset);
+        if (mem == MAP_FAILED) {
+            // regions might be half restored, start over from scratch
+            sim_initialize(sim);
+            return -1;
+        }
+        sim->mem_region[i].mem = mem;
+        offset += sim->mem_region[i].size;
+    }
+    sim->cpu = snap->cpu_state;
+    memcpy(sim->written, snap->written, sizeof(sim->written));
+    if (snap->text_version != sim->text_version) {
+        sim->text_version = snap->text_version;
+        isa_flush_decode_cache(sim);
+        jit_flush(sim);
+        block_flush(sim);
+    }
+    return 0;
 }
 
-uint8_t mem_read_8(uint32_t address)
+void snapshot_free(struct Snapshot *snap)
+{
+    close(snap->fd);
+    free(snap);
+}
+
+struct CPUState sim_get_cpu_state(const struct Simulator *sim)
+{
+    return sim->cpu;
+}
+
+void sim_set_reg(struct Simulator *sim, uint8_t reg_num, uint32_t data)
+{
+    sim->cpu.regs[reg_num] = data;
+}
+
+/* The global API, all on one default simulator */
+
+struct Simulator * sim_default()
 {
-    struct MemoryRegion *region = find_mem_region(address);
-    assert(region != NULL);
-    uint32_t offset = address - region->start;
-    return region->mem[offset];
+    if (default_sim == NULL) {
+        default_sim = sim_create();
+        if (default_sim == NULL) {
+            fprintf(stderr, "Error: Could not reserve guest memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return default_sim;
+}
+
+void initialize()
+{
+    if (sim_initialize(sim_default()) < 0) {
+        fprintf(stderr, "Error: Could not map guest memory\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void reset_cpu()
+{
+    sim_reset_cpu(sim_default());
+}
+
+int load_program(const char *fname)
+{
+    return sim_load_program(sim_default(), fname);
+}
+
+bool mem_mapped(uint32_t address)
+{
+    return sim_mem_mapped(sim_default(), address);
 }
 
 void mem_write_32(uint32_t address, uint32_t data)
 {
-    struct MemoryRegion *region = find_mem_region(address);
-    assert(region != NULL);
-    uint32_t offset = address - region->start;
-    region->mem[offset+0] = (data >> 24) & 0xFF;
-    region->mem[offset+1] = (data >> 16) & 0xFF;
-    region->mem[offset+2] = (data >>  8) & 0xFF;
-    region->mem[offset+3] = (data >>  0) & 0xFF;
+    sim_mem_write_32(sim_default(), address, data);
 }
 
 uint32_t mem_read_32(uint32_t address)
 {
-    struct MemoryRegion *region = find_mem_region(address);
-    assert(region != NULL);
-    uint32_t offset = address - region->start;
-    return
-        (region->mem[offset+0] << 24) |
-        (region->mem[offset+1] << 16) |
-        (region->mem[offset+2] <<  8) |
-        (region->mem[offset+3] <<  0);
+    return sim_mem_read_32(sim_default(), address);
+}
+
+void mem_write_8(uint32_t address, uint8_t data)
+{
+    sim_mem_write_8(sim_default(), address, data);
 }
 
-void load_program(FILE *fp)
+uint8_t mem_read_8(uint32_t address)
 {
-    uint32_t instruction;
-    uint32_t addr = mem_region[MEM_TEXT].start;
-    while (fscanf(fp, "%x\n", &instruction) != EOF) {
-        mem_write_32(addr, instruction);
-        addr += 4;
-    }
+    return sim_mem_read_8(sim_default(), address);
 }
 
 int cpu_cycle()
 {
-    if (!cpu_state.halted) {
-        cpu_state = process_instruction(cpu_state);
-    }
-    return -cpu_state.halted;
+    return sim_cpu_cycle(sim_default());
+}
+
+uint64_t cpu_run(uint64_t max_cycles)
+{
+    return sim_cpu_run(sim_default(), max_cycles);
+}
+
+uint64_t cpu_run_blocks(uint64_t max_cycles)
+{
+    return sim_cpu_run_blocks(sim_default(), max_cycles);
+}
+
+uint64_t cpu_run_jit(uint64_t max_cycles)
+{
+    return sim_cpu_run_jit(sim_default(), max_cycles);
+}
+
+struct Snapshot * snapshot_take()
+{
+    return sim_snapshot_take(sim_default());
+}
+
+int snapshot_restore(const struct Snapshot *snap)
+{
+    return sim_snapshot_restore(sim_default(), snap);
 }
 
 struct CPUState get_cpu_state()
 {
-    return cpu_state;
+    return sim_get_cpu_state(sim_default());
 }
 
 void set_reg(uint8_t reg_num, uint16_t data)
 {
-    cpu_state.regs[reg_num] = data;
+    sim_set_reg(sim_default(), reg_num, data);
 }
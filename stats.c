@@ -0,0 +1,115 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "stats.h"
+#include "cache.h"
+#include "pipeline.h"
+#include "bpred.h"
+#include "simulator.h"
+
+static const char * const op_names[] = {
+#define X(name) #name,
+    INSTR_OPS
+#undef X
+};
+
+void stats_reset(struct Simulator *sim)
+{
+    memset(&sim->stats, 0, sizeof(sim->stats));
+    if (sim->caches != NULL) {
+        cache_reset_counts(sim->caches);
+    }
+    if (sim->pipeline != NULL) {
+        pipeline_reset_counts(sim->pipeline);
+    }
+    if (sim->bpred != NULL) {
+        bpred_reset_counts(sim->bpred);
+    }
+}
+
+void stats_print_count(FILE *fp, enum StatsFormat format, const char *name, uint64_t value)
+{
+    if (format == STATS_CSV) {
+        fprintf(fp, "%s,%llu\n", name, (unsigned long long) value);
+    } else {
+        fprintf(fp, "  %-20s %20llu\n", name, (unsigned long long) value);
+    }
+}
+
+void stats_print_real(FILE *fp, enum StatsFormat format, const char *name, double value)
+{
+    if (format == STATS_CSV) {
+        fprintf(fp, "%s,%.3f\n", name, value);
+    } else {
+        fprintf(fp, "  %-20s %20.3f\n", name, value);
+    }
+}
+
+void stats_print(FILE *fp, const struct Simulator *sim, enum StatsFormat format)
+{
+    const struct SimStats *stats = &sim->stats;
+    uint64_t executed = 0, cond_failed = 0, dp = 0;
+    for (int op = 0; op < NB_INSTR_OPS; op++) {
+        executed += stats->executed[op];
+        cond_failed += stats->cond_failed[op];
+        if (op <= INSTR_MVN) {
+            dp += stats->executed[op];
+        }
+    }
+    const uint64_t *ex = stats->executed;
+
+    if (format == STATS_CSV) {
+        fprintf(fp, "name,value\n");
+    }
+    stats_print_count(fp, format, "instructions", executed + cond_failed);
+    stats_print_count(fp, format, "cond_failed", cond_failed);
+    stats_print_count(fp, format, "data_processing", dp);
+    stats_print_count(fp, format, "load_store", ex[INSTR_LDR] + ex[INSTR_LDRB] +
+                                                ex[INSTR_STR] + ex[INSTR_STRB]);
+    stats_print_count(fp, format, "multiply", ex[INSTR_MUL] + ex[INSTR_MLA]);
+    stats_print_count(fp, format, "branch", ex[INSTR_BL]);
+    stats_print_count(fp, format, "swi", ex[INSTR_SWI]);
+    stats_print_count(fp, format, "undefined", ex[INSTR_UND]);
+    stats_print_count(fp, format, "load_word", ex[INSTR_LDR]);
+    stats_print_count(fp, format, "load_byte", ex[INSTR_LDRB]);
+    stats_print_count(fp, format, "store_word", ex[INSTR_STR]);
+    stats_print_count(fp, format, "store_byte", ex[INSTR_STRB]);
+    stats_print_count(fp, format, "branch_taken", ex[INSTR_BL]);
+    stats_print_count(fp, format, "branch_not_taken", stats->cond_failed[INSTR_BL]);
+    if (format == STATS_TEXT) {
+        fprintf(fp, "  executed by opcode (condition failed):\n");
+        for (int op = 0; op < NB_INSTR_OPS; op++) {
+            if (stats->executed[op] == 0 && stats->cond_failed[op] == 0) {
+                continue;
+            }
+            fprintf(fp, "    %-4s %20llu (%llu)\n", op_names[op],
+                    (unsigned long long) stats->executed[op],
+                    (unsigned long long) stats->cond_failed[op]);
+        }
+    } else {
+        char name[32];
+        for (int op = 0; op < NB_INSTR_OPS; op++) {
+            snprintf(name, sizeof(name), "op_%s", op_names[op]);
+            stats_print_count(fp, format, name, stats->executed[op]);
+            snprintf(name, sizeof(name), "op_%s_cond_failed", op_names[op]);
+            stats_print_count(fp, format, name, stats->cond_failed[op]);
+        }
+    }
+    stats_print_count(fp, format, "runs", stats->nb_runs);
+    stats_print_count(fp, format, "run_instructions", stats->run_instr);
+    stats_print_count(fp, format, "run_ns", stats->run_ns);
+    // instructions per microsecond are millions per second
+    double mips = stats->run_ns > 0 ? 1000.0 * stats->run_instr / stats->run_ns : 0;
+    stats_print_real(fp, format, "mips", mips);
+    if (sim->caches != NULL) {
+        cache_print_stats(fp, sim->caches, format);
+    }
+    if (sim->bpred != NULL) {
+        bpred_print_stats(fp, sim->bpred, format);
+    }
+    if (sim->pipeline != NULL) {
+        // misses stall the whole in-order pipeline
+        uint64_t memory_stalls = sim->caches != NULL ? cache_stall_cycles(sim->caches) : 0;
+        pipeline_print_stats(fp, sim->pipeline, memory_stalls, format);
+    }
+}
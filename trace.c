@@ -0,0 +1,546 @@
+#define _GNU_SOURCE // for pthreads, nanosleep and sched_yield
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <zlib.h>
+#include "trace.h"
+#include "isa.h"
+#include "simulator.h"
+
+/* A trace file is the 8 byte TRACE_MAGIC, a little-endian u32 version, then
+ * one zlib stream of records, one per retired instruction:
+ *
+ *     u8 flags            see the REC_* bits
+ *     u32 instruction     big-endian, left out if REC_WORD_SAME
+ *     regs                nb_regs times {u8 register id, varint zigzag(new
+ *                         - old)}; PC is old + 4 unless it is listed
+ *     cpsr                varint rotl(new ^ old, 4), if REC_CPSR
+ *     accesses            nb_mem times {u8 MEM_ACCESS_* kind, varint
+ *                         zigzag(address - previous access address), varint
+ *                         value}
+ *
+ * A REC_SYNC record instead holds the 16 registers and the CPSR as
+ * little-endian u32, it comes first and whenever the simulator state changed
+ * behind the trace's back (set, restore, file...). The PC of every other
+ * record is the PC the previous one left. REC_WORD_SAME means the word is
+ * the one last traced at that address, so loops cost a few bytes per
+ * instruction before compression.
+ */
+#define TRACE_MAGIC "ARMTRACE"
+#define TRACE_VERSION 1
+
+#define REC_WORD_SAME 0x01
+#define REC_CPSR 0x02
+#define REC_NB_MEM_SHIFT 2 ///> 2 bits
+#define REC_NB_REGS_SHIFT 4 ///> 2 bits
+#define REC_SYNC 0x80
+
+#define TRACE_MAX_MEM 3
+#define TRACE_MAX_REGS 3
+#define TRACE_MAX_RECORD 96
+#define TRACE_RING_SIZE (1 << 22) ///> power of 2
+
+struct MemAccess {
+    uint8_t kind;
+    uint32_t address;
+    uint32_t value;
+};
+
+struct Trace {
+    // single-producer single-consumer ring, head and tail count bytes ever
+    // written and read, on their own cache lines
+    uint8_t *ring;
+    uint64_t head; ///> written by the simulation thread only
+    uint8_t pad_head[56];
+    uint64_t tail; ///> written by the writer thread only
+    uint8_t pad_tail[56];
+    int stop; ///> set once the last record is in the ring
+
+    pthread_t writer;
+    FILE *fp;
+    int error; ///> set by the writer thread if writing failed
+
+    // encoder state, what the decoder will know after the last record
+    bool synced;
+    uint32_t regs[NB_REGS];
+    uint32_t cpsr;
+    uint32_t mem_address;
+    uint32_t words[MEM_TEXT_SIZE / 4]; ///> last word traced at each text address
+    uint8_t word_known[MEM_TEXT_SIZE / 4];
+    uint64_t nb_records;
+
+    // accesses of the instruction being traced
+    uint8_t nb_mem;
+    struct MemAccess mem[TRACE_MAX_MEM];
+};
+
+static inline uint8_t * put_varint(uint8_t *p, uint32_t value)
+{
+    while (value >= 0x80) {
+        *p++ = (uint8_t) value | 0x80;
+        value >>= 7;
+    }
+    *p++ = value;
+    return p;
+}
+
+static inline uint32_t zigzag(uint32_t value)
+{
+    return (value << 1) ^ (uint32_t) ((int32_t) value >> 31);
+}
+
+static inline uint32_t unzigzag(uint32_t value)
+{
+    return (value >> 1) ^ -(value & 1);
+}
+
+static inline uint32_t rotl4(uint32_t value)
+{
+    return value << 4 | value >> 28;
+}
+
+static inline uint8_t * put_le32(uint8_t *p, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) {
+        *p++ = value >> (8 * i);
+    }
+    return p;
+}
+
+/** Drain the ring into the compressed file until stop is set and the ring is
+ * empty
+ */
+static void * writer_main(void *arg)
+{
+    struct Trace *trace = arg;
+    static __thread uint8_t out[1 << 16];
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit(&zs, Z_BEST_SPEED) != Z_OK) {
+        trace->error = 1;
+    }
+    uint64_t tail = trace->tail;
+    for (;;) {
+        uint64_t head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            if (!__atomic_load_n(&trace->stop, __ATOMIC_ACQUIRE)) {
+                struct timespec nap = {0, 100000};
+                nanosleep(&nap, NULL);
+                continue;
+            }
+            // the producer stored head before stop
+            head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+            if (head == tail) {
+                break;
+            }
+        }
+        size_t start = tail & (TRACE_RING_SIZE - 1);
+        size_t size = head - tail;
+        if (size > TRACE_RING_SIZE - start) {
+            size = TRACE_RING_SIZE - start;
+        }
+        zs.next_in = trace->ring + start;
+        zs.avail_in = size;
+        while (zs.avail_in > 0 && !trace->error) {
+            zs.next_out = out;
+            zs.avail_out = sizeof(out);
+            deflate(&zs, Z_NO_FLUSH);
+            size_t nb_out = sizeof(out) - zs.avail_out;
+            if (fwrite(out, 1, nb_out, trace->fp) != nb_out) {
+                trace->error = 1;
+            }
+        }
+        tail += size;
+        __atomic_store_n(&trace->tail, tail, __ATOMIC_RELEASE);
+    }
+    int ret;
+    do {
+        zs.next_out = out;
+        zs.avail_out = sizeof(out);
+        ret = deflate(&zs, Z_FINISH);
+        size_t nb_out = sizeof(out) - zs.avail_out;
+        if (trace->error || fwrite(out, 1, nb_out, trace->fp) != nb_out) {
+            trace->error = 1;
+            break;
+        }
+    } while (ret == Z_OK);
+    deflateEnd(&zs);
+    return NULL;
+}
+
+int trace_start(struct Simulator *sim, const char *fname)
+{
+    if (sim->trace != NULL) {
+        fprintf(stderr, "Error: Already tracing\n");
+        return -1;
+    }
+    struct Trace *trace = calloc(1, sizeof(struct Trace));
+    if (trace != NULL) {
+        trace->ring = malloc(TRACE_RING_SIZE);
+    }
+    if (trace == NULL || trace->ring == NULL) {
+        fprintf(stderr, "Error: Out of memory starting trace\n");
+        goto fail;
+    }
+    trace->fp = fopen(fname, "wb");
+    if (trace->fp == NULL) {
+        fprintf(stderr, "Error: Could not open file %s\n", fname);
+        goto fail;
+    }
+    uint8_t header[12];
+    memcpy(header, TRACE_MAGIC, 8);
+    put_le32(header + 8, TRACE_VERSION);
+    if (fwrite(header, 1, sizeof(header), trace->fp) != sizeof(header) ||
+        pthread_create(&trace->writer, NULL, writer_main, trace) != 0) {
+        fprintf(stderr, "Error: Could not start trace %s\n", fname);
+        fclose(trace->fp);
+        goto fail;
+    }
+    sim->trace = trace;
+    return 0;
+fail:
+    if (trace != NULL) {
+        free(trace->ring);
+    }
+    free(trace);
+    return -1;
+}
+
+int trace_stop(struct Simulator *sim, uint64_t *nb_instr)
+{
+    struct Trace *trace = sim->trace;
+    sim->trace = NULL;
+    __atomic_store_n(&trace->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(trace->writer, NULL);
+    int ret = trace->error || fclose(trace->fp) != 0 ? -1 : 0;
+    if (trace->error) {
+        fclose(trace->fp);
+    }
+    *nb_instr = trace->nb_records;
+    free(trace->ring);
+    free(trace);
+    return ret;
+}
+
+/** Copy a record into the ring, waiting for the writer if it is full */
+static void emit(struct Trace *trace, const uint8_t *record, size_t size)
+{
+    uint64_t head = trace->head;
+    while (head + size - __atomic_load_n(&trace->tail, __ATOMIC_ACQUIRE) > TRACE_RING_SIZE) {
+        sched_yield();
+    }
+    size_t start = head & (TRACE_RING_SIZE - 1);
+    size_t first = size < TRACE_RING_SIZE - start ? size : TRACE_RING_SIZE - start;
+    memcpy(trace->ring + start, record, first);
+    memcpy(trace->ring, record + first, size - first);
+    __atomic_store_n(&trace->head, head + size, __ATOMIC_RELEASE);
+}
+
+/** Emit a REC_SYNC record of the state of cpu */
+static void sync_state(struct Trace *trace, const struct CPUState *cpu)
+{
+    uint8_t record[TRACE_MAX_RECORD];
+    uint8_t *p = record;
+    *p++ = REC_SYNC;
+    for (int i = 0; i < NB_REGS; i++) {
+        p = put_le32(p, cpu->regs[i]);
+    }
+    p = put_le32(p, cpu->CPSR);
+    emit(trace, record, p - record);
+    memcpy(trace->regs, cpu->regs, sizeof(trace->regs));
+    trace->cpsr = cpu->CPSR;
+    trace->synced = true;
+}
+
+/** Emit the record of instruction @ pc, which left cpu behind */
+static void record(struct Trace *trace, uint32_t pc, uint32_t instruction,
+                   const struct CPUState *cpu)
+{
+    uint8_t record[TRACE_MAX_RECORD];
+    uint8_t *p = record + 1;
+    uint8_t flags = 0;
+
+    uint32_t offset = pc - MEM_TEXT_START;
+    if (offset < MEM_TEXT_SIZE && trace->word_known[offset >> 2] &&
+        trace->words[offset >> 2] == instruction) {
+        flags |= REC_WORD_SAME;
+    } else {
+        *p++ = instruction >> 24;
+        *p++ = instruction >> 16;
+        *p++ = instruction >> 8;
+        *p++ = instruction;
+        if (offset < MEM_TEXT_SIZE) {
+            trace->words[offset >> 2] = instruction;
+            trace->word_known[offset >> 2] = 1;
+        }
+    }
+
+    trace->regs[PC] += 4;
+    uint8_t nb_regs = 0;
+    for (uint8_t i = 0; i < NB_REGS && nb_regs < TRACE_MAX_REGS; i++) {
+        if (cpu->regs[i] != trace->regs[i]) {
+            *p++ = i;
+            p = put_varint(p, zigzag(cpu->regs[i] - trace->regs[i]));
+            trace->regs[i] = cpu->regs[i];
+            nb_regs++;
+        }
+    }
+    flags |= nb_regs << REC_NB_REGS_SHIFT;
+
+    if (cpu->CPSR != trace->cpsr) {
+        flags |= REC_CPSR;
+        p = put_varint(p, rotl4(cpu->CPSR ^ trace->cpsr));
+        trace->cpsr = cpu->CPSR;
+    }
+
+    for (uint8_t i = 0; i < trace->nb_mem; i++) {
+        const struct MemAccess *access = &trace->mem[i];
+        *p++ = access->kind;
+        p = put_varint(p, zigzag(access->address - trace->mem_address));
+        p = put_varint(p, access->value);
+        trace->mem_address = access->address;
+    }
+    flags |= trace->nb_mem << REC_NB_MEM_SHIFT;
+
+    record[0] = flags;
+    emit(trace, record, p - record);
+    trace->nb_records++;
+    trace->nb_mem = 0;
+}
+
+void trace_sync(struct Simulator *sim)
+{
+    struct Trace *trace = sim->trace;
+    trace->nb_mem = 0; // left over by an instruction which faulted
+    if (!trace->synced || trace->cpsr != sim->cpu.CPSR ||
+        memcmp(trace->regs, sim->cpu.regs, sizeof(trace->regs)) != 0) {
+        sync_state(trace, &sim->cpu);
+    }
+}
+
+void trace_instruction(struct Simulator *sim, uint32_t pc, uint32_t instruction)
+{
+    record(sim->trace, pc, instruction, &sim->cpu);
+}
+
+void trace_memory(struct Trace *trace, uint32_t address, uint8_t kind, uint32_t value)
+{
+    if (trace->nb_mem == TRACE_MAX_MEM) {
+        return;
+    }
+    struct MemAccess *access = &trace->mem[trace->nb_mem++];
+    access->kind = kind;
+    access->address = address;
+    access->value = value;
+}
+
+/** Reader of the decompressed records of a trace file */
+struct TraceReader {
+    FILE *fp;
+    z_stream zs;
+    uint8_t in[1 << 16];
+    uint8_t out[1 << 16];
+    size_t pos, end; ///> unread bytes of out
+    int error;
+};
+
+/** Next decompressed byte.
+ * \return -1 at the end of the trace
+ */
+static int next_byte(struct TraceReader *reader)
+{
+    while (reader->pos == reader->end) {
+        if (reader->error) {
+            return -1;
+        }
+        if (reader->zs.avail_in == 0) {
+            reader->zs.next_in = reader->in;
+            reader->zs.avail_in = fread(reader->in, 1, sizeof(reader->in), reader->fp);
+        }
+        reader->zs.next_out = reader->out;
+        reader->zs.avail_out = sizeof(reader->out);
+        int ret = inflate(&reader->zs, Z_NO_FLUSH);
+        reader->pos = 0;
+        reader->end = sizeof(reader->out) - reader->zs.avail_out;
+        if (ret == Z_STREAM_END) {
+            reader->error = reader->end == 0 ? 2 : 0;
+            if (reader->end == 0) {
+                return -1;
+            }
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            reader->error = 1;
+        } else if (reader->end == 0 && reader->zs.avail_in == 0 && feof(reader->fp)) {
+            reader->error = 1; // truncated
+        }
+    }
+    return reader->out[reader->pos++];
+}
+
+static bool read_varint(struct TraceReader *reader, uint32_t *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        int byte = next_byte(reader);
+        if (byte < 0) {
+            return false;
+        }
+        *value |= (uint32_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool read_le32(struct TraceReader *reader, uint32_t *value)
+{
+    *value = 0;
+    for (int i = 0; i < 4; i++) {
+        int byte = next_byte(reader);
+        if (byte < 0) {
+            return false;
+        }
+        *value |= (uint32_t) byte << (8 * i);
+    }
+    return true;
+}
+
+/** Decode and print one record.
+ * \return 1 if one was printed, 0 at the end of the trace, -1 if corrupt
+ */
+static int decode_record(struct TraceReader *reader, FILE *out, uint32_t *regs, uint32_t *cpsr,
+                         uint32_t *mem_address, uint32_t *words, uint8_t *word_known)
+{
+    int flags = next_byte(reader);
+    if (flags < 0) {
+        return reader->error == 2 ? 0 : -1;
+    }
+    if (flags & REC_SYNC) {
+        for (int i = 0; i < NB_REGS; i++) {
+            if (!read_le32(reader, &regs[i])) {
+                return -1;
+            }
+        }
+        if (!read_le32(reader, cpsr)) {
+            return -1;
+        }
+        fprintf(out, "-- state");
+        for (int i = 0; i < NB_REGS; i++) {
+            fprintf(out, " r%d=%08x", i, regs[i]);
+        }
+        fprintf(out, " cpsr=%08x\n", *cpsr);
+        return 1;
+    }
+
+    uint32_t pc = regs[PC];
+    uint32_t offset = pc - MEM_TEXT_START;
+    uint32_t instruction = 0;
+    if (flags & REC_WORD_SAME) {
+        if (offset >= MEM_TEXT_SIZE || !word_known[offset >> 2]) {
+            return -1;
+        }
+        instruction = words[offset >> 2];
+    } else {
+        for (int i = 0; i < 4; i++) {
+            int byte = next_byte(reader);
+            if (byte < 0) {
+                return -1;
+            }
+            instruction = instruction << 8 | byte;
+        }
+        if (offset < MEM_TEXT_SIZE) {
+            words[offset >> 2] = instruction;
+            word_known[offset >> 2] = 1;
+        }
+    }
+    fprintf(out, "%08x: %08x", pc, instruction);
+
+    regs[PC] += 4;
+    for (int i = 0; i < ((flags >> REC_NB_REGS_SHIFT) & 0x3); i++) {
+        int reg = next_byte(reader);
+        uint32_t delta;
+        if (reg < 0 || reg >= NB_REGS || !read_varint(reader, &delta)) {
+            return -1;
+        }
+        regs[reg] += unzigzag(delta);
+        if (reg == PC) {
+            fprintf(out, " pc=%08x", regs[reg]);
+        } else {
+            fprintf(out, " r%d=%08x", reg, regs[reg]);
+        }
+    }
+    if (flags & REC_CPSR) {
+        uint32_t delta;
+        if (!read_varint(reader, &delta)) {
+            return -1;
+        }
+        *cpsr ^= delta >> 4 | delta << 28;
+        fprintf(out, " cpsr=%08x", *cpsr);
+    }
+    for (int i = 0; i < ((flags >> REC_NB_MEM_SHIFT) & 0x3); i++) {
+        int kind = next_byte(reader);
+        uint32_t delta, value;
+        if (kind < 0 || !read_varint(reader, &delta) || !read_varint(reader, &value)) {
+            return -1;
+        }
+        *mem_address += unzigzag(delta);
+        fprintf(out, " [%08x]%s%s%0*x", *mem_address, kind & MEM_ACCESS_BYTE ? ".b" : "",
+                kind & MEM_ACCESS_WRITE ? "<=" : "=>", kind & MEM_ACCESS_BYTE ? 2 : 8, value);
+    }
+    fputc('\n', out);
+    return 1;
+}
+
+int trace_decode(const char *fname, FILE *out)
+{
+    FILE *fp = fopen(fname, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Could not open file %s\n", fname);
+        return -1;
+    }
+    uint8_t header[12];
+    uint32_t version = 0;
+    bool valid = fread(header, 1, sizeof(header), fp) == sizeof(header) &&
+                 memcmp(header, TRACE_MAGIC, 8) == 0;
+    for (int i = 0; valid && i < 4; i++) {
+        version |= (uint32_t) header[8 + i] << (8 * i);
+    }
+    if (!valid || version != TRACE_VERSION) {
+        fprintf(stderr, "Error: %s is not a version %d trace\n", fname, TRACE_VERSION);
+        fclose(fp);
+        return -1;
+    }
+
+    struct TraceReader *reader = calloc(1, sizeof(struct TraceReader));
+    uint32_t *words = malloc(MEM_TEXT_SIZE);
+    uint8_t *word_known = calloc(MEM_TEXT_SIZE / 4, 1);
+    int ret = -1;
+    if (reader == NULL || words == NULL || word_known == NULL ||
+        inflateInit(&reader->zs) != Z_OK) {
+        fprintf(stderr, "Error: Out of memory decoding %s\n", fname);
+        goto out;
+    }
+    reader->fp = fp;
+    uint32_t regs[NB_REGS] = {0};
+    uint32_t cpsr = 0, mem_address = 0;
+    int status;
+    while ((status = decode_record(reader, out, regs, &cpsr, &mem_address, words,
+                                   word_known)) > 0) {
+    }
+    inflateEnd(&reader->zs);
+    if (status < 0) {
+        fprintf(stderr, "Error: %s: Corrupt or truncated trace\n", fname);
+    } else {
+        ret = 0;
+    }
+out:
+    free(word_known);
+    free(words);
+    free(reader);
+    fclose(fp);
+    return ret;
+}